@@ -12,6 +12,8 @@
 */
 
 #include "SQLite.h"
+#include "SQLiteCache.h"
+#include "SQLiteThread.h"
 using namespace std;
 
 #ifdef OS_WIN
@@ -28,6 +30,7 @@ using namespace std;
 
 static int busy_handler(void *, int attempts)
 {
+	SQLite::atomicAdd(&SQLite::busyWaits, 1);
 	if (attempts < 50)
 	{
 		// nasty. makes os scheduler context-switch
@@ -121,8 +124,23 @@ namespace SQLite
 		{
 			throw Exception("Transaction alreay finished");
 		}
-		db.execute("COMMIT");
-		finished = true;
+		if (!tryCommit())
+		{
+			throw Exception(db.ctx);
+		}
+	}
+	Status Trans::tryCommit()
+	{
+		if (finished)
+		{
+			return Status(SQLITE_MISUSE);
+		}
+		Status rv = db.tryExecute("COMMIT");
+		if (rv.ok())
+		{
+			finished = true;
+		}
+		return rv;
 	}
 	void Trans::rollback()
 	{
@@ -135,30 +153,50 @@ namespace SQLite
 	}
 
 	DB::DB(const char *aDB)
-	: ctx(NULL)
+	: ctx(NULL), planChecker(NULL), explaining(false), authorizer(NULL), cache(NULL), changes(NULL),
+	sessions(0), deadline(0), stmtDeadline(0), timedOut(false), progressOps(1000), progressSet(false),
+	formats(NULL)
 	{
 		open(aDB);
 	}
 	DB::DB(const string& aDB)
-	: ctx(NULL)
+	: ctx(NULL), planChecker(NULL), explaining(false), authorizer(NULL), cache(NULL), changes(NULL),
+	sessions(0), deadline(0), stmtDeadline(0), timedOut(false), progressOps(1000), progressSet(false),
+	formats(NULL)
 	{
 		open(aDB.c_str());
 	}
+	DB::DB(const string& aDB, const string& aVfs)
+	: ctx(NULL), planChecker(NULL), explaining(false), authorizer(NULL), cache(NULL), changes(NULL),
+	sessions(0), deadline(0), stmtDeadline(0), timedOut(false), progressOps(1000), progressSet(false),
+	formats(NULL)
+	{
+		open(aDB.c_str(), aVfs.c_str());
+	}
+	DB::DB(const string& aDB, int aFlags)
+	: ctx(NULL), planChecker(NULL), explaining(false), authorizer(NULL), cache(NULL), changes(NULL),
+	sessions(0), deadline(0), stmtDeadline(0), timedOut(false), progressOps(1000), progressSet(false),
+	formats(NULL)
+	{
+		open(aDB.c_str(), NULL, aFlags);
+	}
 #ifdef __BORLANDC__
 	DB::DB(const AnsiString& aDB)
-	: ctx(NULL)
+	: ctx(NULL), planChecker(NULL), explaining(false), authorizer(NULL), cache(NULL), changes(NULL),
+	sessions(0), deadline(0), stmtDeadline(0), timedOut(false), progressOps(1000), progressSet(false),
+	formats(NULL)
 	{
 		open(aDB.c_str());
 	}
 #endif
-	void DB::open(const char *aDB)
+	void DB::open(const char *aDB, const char *aVfs, int aFlags)
 	{
 		db = aDB;
 		if (SQLITE_OK != sqlite3_open_v2(
 			aDB,
 			&ctx,
-			SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
-			NULL
+			aFlags,
+			aVfs
 		))
 		{
 			throw Exception(ctx);
@@ -172,6 +210,8 @@ namespace SQLite
 
 	DB::~DB()
 	{
+		disableCache();
+		dropFormats();
 		if (ctx)
 		{
 			sqlite3_close(ctx);
@@ -181,6 +221,10 @@ namespace SQLite
 		{
 			delete *i;
 		}
+		for (TokenizerList::iterator i = tokenizers.begin(), e = tokenizers.end(); i != e; ++i)
+		{
+			delete *i;
+		}
 	}
 
 	Stmt DB::prepare(const string &aQuery)
@@ -219,20 +263,155 @@ namespace SQLite
 	{
 		va_list ap;
 		va_start(ap, aQuery);
-		char *o = sqlite3_vmprintf(aQuery, ap);
+		try
+		{
+			executeFormat(aQuery, ap);
+		}
+		catch (...)
+		{
+			va_end(ap);
+			throw;
+		}
 		va_end(ap);
-
-		string Query(o);
-		sqlite3_free(o);
-		execute(Query);
+	}
+	// the update hook is shared by the result cache and, without preupdate
+	// hooks, the change stream; the authorizer by the result cache and the
+	// user's Authorizer
+	void DB::setHooks()
+	{
+		bool update = cache != NULL;
+#ifndef SQLITE_ENABLE_PREUPDATE_HOOK
+		update = update || changes != NULL;
+#endif
+		sqlite3_update_hook(ctx, update ? updateHook : NULL, this);
+		sqlite3_set_authorizer(ctx, cache || authorizer ? authorizerHook : NULL, this);
+	}
+	void DB::setAuthorizer(Authorizer *aAuthorizer)
+	{
+		authorizer = aAuthorizer;
+		setHooks();
+	}
+	int DB::authorizerHook(void *aDB, int aAction, const char *aArg1, const char *aArg2, const char *aName, const char *aTrigger)
+	{
+		DB *db = reinterpret_cast<DB*>(aDB);
+		if (db->cache)
+		{
+			db->cache->authorize(aAction, aArg1);
+		}
+		if (!db->authorizer)
+		{
+			return SQLITE_OK;
+		}
+		try
+		{
+			return db->authorizer->authorize(aAction, aArg1, aArg2, aName, aTrigger);
+		}
+		catch (...)
+		{
+			return SQLITE_DENY;
+		}
+	}
+	void DB::updateHook(void *aDB, int aOp, const char *aName, const char *aTable, sqlite3_int64 aRowid)
+	{
+		DB *db = reinterpret_cast<DB*>(aDB);
+		if (db->cache)
+		{
+			db->cache->tableChanged(aTable);
+		}
+#ifndef SQLITE_ENABLE_PREUPDATE_HOOK
+		if (db->changes)
+		{
+			db->changes->capture(aOp, aName, aTable, aRowid, aRowid);
+		}
+#else
+		// the change stream uses the preupdate hook
+		(void)aOp;
+		(void)aName;
+		(void)aRowid;
+#endif
 	}
 
+	Status DB::tryExecute(const string &aQuery)
+	{
+		try
+		{
+			return prepare(aQuery).tryExecute();
+		}
+		catch (Exception& ex)
+		{
+			// preparing failed
+			if (ex.getErrorCode() == -1)
+			{
+				throw;
+			}
+			return Status(ex.getErrorCode());
+		}
+	}
 
 	__int64 DB::lastInsertId() const
 	{
 		return sqlite3_last_insert_rowid(ctx);
 	}
 
+	void DB::setAutoCheckpoint(int aPages)
+	{
+		if (SQLITE_OK != sqlite3_wal_autocheckpoint(ctx, aPages))
+		{
+			throw Exception(ctx);
+		}
+	}
+
+	void DB::cancel()
+	{
+		sqlite3_interrupt(ctx);
+	}
+	void DB::setProgressInterval(int aOpcodes)
+	{
+		progressOps = aOpcodes;
+		if (progressSet)
+		{
+			sqlite3_progress_handler(ctx, progressOps, progressHandler, this);
+		}
+	}
+	void DB::useProgressHandler()
+	{
+		if (!progressSet)
+		{
+			sqlite3_progress_handler(ctx, progressOps, progressHandler, this);
+			progressSet = true;
+		}
+	}
+	int DB::progressHandler(void *aDB)
+	{
+		DB *db = reinterpret_cast<DB*>(aDB);
+		__int64 limit = db->deadline;
+		if (db->stmtDeadline && (!limit || db->stmtDeadline < limit))
+		{
+			limit = db->stmtDeadline;
+		}
+		if (limit && clockMicros() > limit)
+		{
+			db->timedOut = true;
+			return 1;
+		}
+		return 0;
+	}
+
+	Deadline::Deadline(DB& aDB, unsigned aMs)
+		: db(aDB), previous(aDB.deadline)
+	{
+		__int64 limit = clockMicros() + (__int64)aMs * 1000;
+		if (!previous || limit < previous)
+		{
+			db.deadline = limit;
+		}
+		db.useProgressHandler();
+	}
+	Deadline::~Deadline()
+	{
+		db.deadline = previous;
+	}
+
 	void DB::registerFunction(Function *aFunc)
 	{
 		if (SQLITE_OK != sqlite3_create_function(
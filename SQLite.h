@@ -21,6 +21,8 @@
 
 #include <string>
 #include <deque>
+#include <vector>
+#include <map>
 #include <sqlite3.h>
 
 #ifdef __BORLANDC__
@@ -45,6 +47,13 @@ namespace SQLite
 			Message = m;
 			errorCode = sqlite3_errcode(ctx);
 		}
+		Exception(const int aCode, const std::string& aMsg)
+			: errorCode(aCode), ::Exception("")
+		{
+			AnsiString m;
+			m.sprintf("%s (Code: %d)", aMsg.c_str(), aCode);
+			Message = m;
+		}
 		explicit Exception(const std::string& error)
 			: ::Exception(error.c_str())
 		{
@@ -98,6 +107,9 @@ namespace SQLite
 		Exception(const std::string &aMsg)
 			: error(aMsg), errorCode(-1)
 		{}
+		Exception(const int aCode, const std::string &aMsg)
+			: error(aMsg), errorCode(aCode)
+		{}
 		Exception(const int aCode)
 			: errorCode(aCode)
 		{
@@ -138,6 +150,23 @@ namespace SQLite
 		}
 	};
 
+	// SQLITE_INTERRUPT, raised by DB::cancel() or an expired deadline
+	class Interrupted : public Exception
+	{
+	private:
+		bool timeout;
+
+	public:
+		Interrupted(sqlite3 *ctx, bool aTimeout)
+			: Exception(ctx), timeout(aTimeout)
+		{}
+		Interrupted(const std::string &aMsg, bool aTimeout)
+			: Exception(SQLITE_INTERRUPT, aMsg), timeout(aTimeout)
+		{}
+
+		bool isTimeout() const { return timeout; }
+	};
+
 	class Value;
 	class Context
 	{
@@ -180,6 +209,107 @@ namespace SQLite
 		virtual void operator()(Context &) = 0;
 	};
 
+	// Receives the tokens of an FTS5 tokenizer
+	class TokenSink
+	{
+		friend class Tokenizer;
+	private:
+		void *ctx;
+		int (*xToken)(void *, int, const char *, int, int, int);
+		int rc;
+
+		TokenSink(void *aCtx, int (*aToken)(void *, int, const char *, int, int, int))
+			: ctx(aCtx), xToken(aToken), rc(SQLITE_OK)
+		{}
+
+	public:
+		// aStart/aEnd are the byte offsets of the token within the text.
+		// Returns false if tokenizing should stop.
+		bool token(const char *aToken, unsigned aLength, unsigned aStart, unsigned aEnd, bool aColocated = false)
+		{
+			rc = xToken(ctx, aColocated ? FTS5_TOKEN_COLOCATED : 0, aToken, (int)aLength, (int)aStart, (int)aEnd);
+			return rc == SQLITE_OK;
+		}
+	};
+
+	// A custom FTS5 tokenizer, see DB::registerTokenizer()
+	class Tokenizer
+	{
+		friend class DB;
+	private:
+		std::string name;
+
+		static int xCreate(void *aTokenizer, const char **aArgs, int aCount, Fts5Tokenizer **aOut);
+		static void xDelete(Fts5Tokenizer *);
+		static int xTokenize(Fts5Tokenizer *aTokenizer, void *aCtx, int aFlags, const char *aText, int aLength, int (*aToken)(void *, int, const char *, int, int, int));
+
+	public:
+		explicit Tokenizer(const std::string& aName);
+		virtual ~Tokenizer() {}
+
+		// aFlags is one of FTS5_TOKENIZE_DOCUMENT, _QUERY (maybe with
+		// _PREFIX) or _AUX. May run concurrently on connections sharing
+		// the instance.
+		virtual void tokenize(const char *aText, unsigned aLength, int aFlags, TokenSink& aSink) = 0;
+	};
+
+	// Splits on everything but ASCII letters, digits and UTF-8 sequences
+	// and folds ASCII to lower case. Scans 16 bytes at a time with SSE2.
+	class WordTokenizer : public Tokenizer
+	{
+	public:
+		explicit WordTokenizer(const std::string& aName = "words")
+			: Tokenizer(aName)
+		{}
+
+		virtual void tokenize(const char *aText, unsigned aLength, int aFlags, TokenSink& aSink);
+	};
+
+	// Collations for DB::registerCollation(). A comparator is any copyable
+	// functor (or function pointer) taking (a, aLength, b, bLength) and returning
+	// a negative value, 0 or a positive value; it must not throw.
+	typedef int (*CollationFunc)(const char *a, unsigned aLength, const char *b, unsigned bLength);
+
+	template<typename Compare>
+	class CollationAdapter
+	{
+	public:
+		static int compare(void *aCompare, int aLength, const void *a, int bLength, const void *b)
+		{
+			return (*static_cast<Compare*>(aCompare))(
+				static_cast<const char*>(a), (unsigned)aLength,
+				static_cast<const char*>(b), (unsigned)bLength
+				);
+		}
+		static void destroy(void *aCompare)
+		{
+			delete static_cast<Compare*>(aCompare);
+		}
+	};
+
+	// Folds ASCII letters, compares everything else byte-wise. Like
+	// NOCASE, but compares 16 bytes at a time with SSE2.
+	class AsciiNoCase
+	{
+	public:
+		int operator()(const char *a, unsigned aLength, const char *b, unsigned bLength) const;
+	};
+
+	// Compares runs of digits by their numeric value ("file9" < "file10")
+	// and folds ASCII letters in between
+	class NaturalOrder
+	{
+	public:
+		int operator()(const char *a, unsigned aLength, const char *b, unsigned bLength) const;
+	};
+
+	// Byte-wise, which for valid UTF-8 is code point order
+	class Utf8Order
+	{
+	public:
+		int operator()(const char *a, unsigned aLength, const char *b, unsigned bLength) const;
+	};
+
 	class Blob
 	{
 	private:
@@ -207,6 +337,51 @@ namespace SQLite
 
 	};
 
+	// Binds SQL NULL
+	class Null
+	{};
+
+	// Text bound without copying (SQLITE_STATIC); the data must outlive the
+	// binding, i.e. until the statement is rebound, reset or finalized.
+	// Strings must be wrapped explicitly, temporaries would dangle.
+	class StaticText
+	{
+	private:
+		const char *data;
+		const unsigned length;
+
+	public:
+		StaticText(const char *aData)
+			: data(aData), length((unsigned)strlen(aData))
+		{}
+		StaticText(const char *aData, const unsigned aLength)
+			: data(aData), length(aLength)
+		{}
+		explicit StaticText(const std::string& aData)
+			: data(aData.data()), length((unsigned)aData.length())
+		{}
+
+		const char *getData() const { return data; }
+		const unsigned getLength() const { return length; }
+	};
+
+	// A value that may be NULL
+	template<typename T>
+	class Nullable
+	{
+	private:
+		T value;
+		bool null;
+
+	public:
+		Nullable() : value(), null(true) {}
+		Nullable(const T& aValue) : value(aValue), null(false) {}
+		Nullable(const Null&) : value(), null(true) {}
+
+		bool isNull() const { return null; }
+		const T& get() const { return value; }
+	};
+
 	class BaseData
 	{
 	protected:
@@ -349,6 +524,233 @@ namespace SQLite
 	class DB;
 	class Stmt;
 
+	// Result of the non-throwing try*() calls: carries the raw SQLite code,
+	// so expected failures like SQLITE_BUSY or SQLITE_CONSTRAINT can be
+	// handled without unwinding. The message is available from
+	// DB::getErrorMsg() until the next call on the connection.
+	class Status
+	{
+	private:
+		int code;
+
+	public:
+		Status(const int aCode) : code(aCode) {}
+
+		bool ok() const { return code == SQLITE_OK || code == SQLITE_ROW || code == SQLITE_DONE; }
+		bool operator!() const { return !ok(); }
+
+		bool hasRow() const { return code == SQLITE_ROW; }
+		bool isBusy() const { return (code & 0xff) == SQLITE_BUSY || (code & 0xff) == SQLITE_LOCKED; }
+		bool isConstraint() const { return (code & 0xff) == SQLITE_CONSTRAINT; }
+		bool isInterrupt() const { return code == SQLITE_INTERRUPT; }
+
+		const int getCode() const { return code; }
+	};
+
+	// One row of EXPLAIN QUERY PLAN; a Plan lists the nodes in output
+	// order, so each node follows its parent
+	class PlanNode
+	{
+	public:
+		int id;
+		int parent;
+		unsigned depth;
+		std::string detail;
+		// Scans the result of a subquery or CTE (MATERIALIZE/CO-ROUTINE)
+		bool subquery;
+
+		PlanNode(int aId, int aParent, unsigned aDepth, const std::string& aDetail)
+			: id(aId), parent(aParent), depth(aDepth), detail(aDetail), subquery(false)
+		{}
+
+		// Scans a whole table without using any index
+		bool isFullScan() const;
+		bool usesTempBTree() const;
+	};
+	typedef std::vector<PlanNode> Plan;
+
+	// sqlite3_stmt_status counters
+	class StmtStatus
+	{
+	public:
+		int fullscanSteps;
+		int sorts;
+		int autoindexes;
+		int vmSteps;
+
+		StmtStatus() : fullscanSteps(0), sorts(0), autoindexes(0), vmSteps(0) {}
+	};
+
+	class ResultData;
+
+	// A value of a materialized ResultSet
+	class Field : public BaseData
+	{
+		friend class ResultSet;
+		friend class PrefetchCursor;
+
+	private:
+		const ResultData *data;
+		unsigned cell;
+
+		Field(const ResultData *aData, unsigned aCell)
+			: data(aData), cell(aCell)
+		{}
+
+	public:
+		virtual int asInt() const;
+		virtual __int64 asInt64() const;
+		virtual double asDouble() const;
+		virtual const char *asChar() const;
+		virtual std::string asString() const;
+#ifdef __BORLANDC__
+		virtual AnsiString asAString() const;
+#endif
+		virtual Blob asBlob() const;
+
+		virtual int getType() const;
+	};
+
+	// All rows of a statement, copied out of SQLite into one buffer.
+	// Copies share the (immutable) data.
+	class ResultSet
+	{
+		friend class Stmt;
+		friend class ChangeStream;
+
+	private:
+		ResultData *data;
+
+		explicit ResultSet(ResultData *aData);
+
+	public:
+		ResultSet();
+		ResultSet(const ResultSet &c);
+		~ResultSet();
+
+		ResultSet& operator=(const ResultSet &c);
+
+		unsigned getRowCount() const;
+		unsigned getColumnCount() const;
+		unsigned getSize() const;
+
+		Field value(unsigned row, unsigned col) const;
+	};
+
+	class CacheStats
+	{
+	public:
+		unsigned hits;
+		unsigned misses;
+		unsigned invalidations;
+		unsigned evictions;
+		unsigned expirations;
+		unsigned entries;
+		unsigned bytes;
+
+		CacheStats()
+			: hits(0), misses(0), invalidations(0), evictions(0),
+			expirations(0), entries(0), bytes(0)
+		{}
+	};
+
+	// sqlite3_db_status() of one connection. Memory in bytes.
+	class DBStats
+	{
+	public:
+		int cacheUsed;
+		int cacheUsedShared;
+		// counters
+		int cacheHits;
+		int cacheMisses;
+		int cacheWrites;
+		int cacheSpills;
+		int lookasideHits;
+		int lookasideMissSize;
+		int lookasideMissFull;
+		// lookaside slots
+		int lookasideUsed;
+		int lookasideHighwater;
+		int schemaUsed;
+		int stmtUsed;
+
+		DBStats()
+			: cacheUsed(0), cacheUsedShared(0), cacheHits(0), cacheMisses(0),
+			cacheWrites(0), cacheSpills(0), lookasideHits(0), lookasideMissSize(0),
+			lookasideMissFull(0), lookasideUsed(0), lookasideHighwater(0),
+			schemaUsed(0), stmtUsed(0)
+		{}
+
+		// The counters since aEarlier; everything else as of this one
+		DBStats since(const DBStats& aEarlier) const;
+	};
+
+	// sqlite3_status64() of the process. Memory in bytes, page cache
+	// slots in pages.
+	class LibraryStats
+	{
+	public:
+		__int64 memoryUsed;
+		__int64 memoryHighwater;
+		__int64 mallocCount;
+		__int64 mallocCountHighwater;
+		// largest single allocations requested
+		__int64 mallocSizeHighwater;
+		__int64 pagecacheSizeHighwater;
+		__int64 pagecacheUsed;
+		__int64 pagecacheHighwater;
+		// page cache memory that did not fit the configured slots
+		__int64 pagecacheOverflow;
+		__int64 pagecacheOverflowHighwater;
+		// retries by the busy handler of all connections
+		__int64 busyWaits;
+
+		LibraryStats()
+			: memoryUsed(0), memoryHighwater(0), mallocCount(0), mallocCountHighwater(0),
+			mallocSizeHighwater(0), pagecacheSizeHighwater(0), pagecacheUsed(0),
+			pagecacheHighwater(0), pagecacheOverflow(0), pagecacheOverflowHighwater(0),
+			busyWaits(0)
+		{}
+	};
+
+	class Library
+	{
+	public:
+		// aReset restarts the high-water marks and busyWaits
+		static LibraryStats stats(bool aReset = false);
+	};
+
+	class ImageData;
+
+	// A serialized database: the pages of a database file in one
+	// contiguous buffer. Copies share the buffer.
+	class Image
+	{
+		friend class DB;
+
+	private:
+		ImageData *data;
+
+		explicit Image(ImageData *aData);
+
+	public:
+		Image();
+		Image(const Image &c);
+		~Image();
+
+		Image& operator=(const Image &c);
+
+		// Maps a database file into memory
+		static Image fromFile(const std::string& aFile);
+		// Uses aData in place; it must outlive all connections using the image
+		static Image fromBuffer(const void *aData, size_t aLength);
+
+		const void *getData() const;
+		size_t getSize() const;
+
+		void save(const std::string& aFile) const;
+	};
+
 	class DataItr
 	{
 	public:
@@ -371,6 +773,8 @@ namespace SQLite
 		~Trans();
 		void commit();
 		void rollback();
+
+		Status tryCommit();
 	};
 
 
@@ -379,18 +783,41 @@ namespace SQLite
 		friend class DB;
 		friend class Data;
 		friend class Exception;
+		friend class PrefetchCursor;
+		friend class StatementRegistry;
+		friend class FormatCache;
+		friend class BulkLoad;
 	private:
 		sqlite3_stmt *stmt;
 
-		std::string query;
+		std::string sql;
 		std::string tail;
 
 		DB& owner;
 
 		bool ok, done, result;
+		unsigned params;
+
+		unsigned timeout;
+		__int64 runStart;
+		// changes pending in the ChangeStream when the run started
+		unsigned changeMark;
+
+		// tables read, when prepared with the result cache enabled
+		bool tracked;
+		std::vector<std::string> reads;
+		// the bound values, typed and exact, keying the cached results
+		std::vector<std::string> bindings;
 
 	private:
 		Stmt(DB& aOwner, const std::string &aQuery);
+
+		Status bound(int aCode, unsigned idx, int aType, const void *aData, unsigned aLength);
+
+		void beginBind(unsigned count);
+		void checkBind(const Status& rv);
+		template<typename T>
+		void bindOne(unsigned idx, const T& value) { checkBind(tryBind(idx, value)); }
 #ifdef __BORLANDC__
 		Stmt(DB& aOwner, const AnsiString &aQuery);
 #endif
@@ -414,20 +841,183 @@ namespace SQLite
 		void bind(unsigned idx, const AnsiString& value);
 #endif
 		void bind(unsigned idx, const void *value, const unsigned length);
+		void bind(unsigned idx, const char *value);
+		void bind(unsigned idx, const Blob& value);
+		void bind(unsigned idx, const StaticText& value);
+
+		Status tryReset();
+		Status tryBind(unsigned idx);
+		Status tryBind(unsigned idx, const int value);
+		Status tryBind(unsigned idx, const __int64& value);
+		Status tryBind(unsigned idx, const double& value);
+		Status tryBind(unsigned idx, const std::string& value);
+#ifdef __BORLANDC__
+		Status tryBind(unsigned idx, const AnsiString& value);
+#endif
+		Status tryBind(unsigned idx, const void *value, const unsigned length);
+		Status tryBind(unsigned idx, const char *value);
+		Status tryBind(unsigned idx, const Blob& value);
+		Status tryBind(unsigned idx, const StaticText& value);
+		Status tryBind(unsigned idx, const Null&) { return tryBind(idx); }
+		template<typename T>
+		Status tryBind(unsigned idx, const Nullable<T>& value)
+		{
+			return value.isNull() ? tryBind(idx) : tryBind(idx, value.get());
+		}
 
-		const std::string& getQuery() const { return query; }
+		// Binds all parameters at once, resetting the statement first.
+		// The argument count must match getParamCount().
+		template<typename A1>
+		Stmt& bindAll(const A1& a1)
+		{
+			beginBind(1);
+			bindOne(1, a1);
+			return *this;
+		}
+		template<typename A1, typename A2>
+		Stmt& bindAll(const A1& a1, const A2& a2)
+		{
+			beginBind(2);
+			bindOne(1, a1);
+			bindOne(2, a2);
+			return *this;
+		}
+		template<typename A1, typename A2, typename A3>
+		Stmt& bindAll(const A1& a1, const A2& a2, const A3& a3)
+		{
+			beginBind(3);
+			bindOne(1, a1);
+			bindOne(2, a2);
+			bindOne(3, a3);
+			return *this;
+		}
+		template<typename A1, typename A2, typename A3, typename A4>
+		Stmt& bindAll(const A1& a1, const A2& a2, const A3& a3, const A4& a4)
+		{
+			beginBind(4);
+			bindOne(1, a1);
+			bindOne(2, a2);
+			bindOne(3, a3);
+			bindOne(4, a4);
+			return *this;
+		}
+		template<typename A1, typename A2, typename A3, typename A4, typename A5>
+		Stmt& bindAll(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5)
+		{
+			beginBind(5);
+			bindOne(1, a1);
+			bindOne(2, a2);
+			bindOne(3, a3);
+			bindOne(4, a4);
+			bindOne(5, a5);
+			return *this;
+		}
+		template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
+		Stmt& bindAll(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5, const A6& a6)
+		{
+			beginBind(6);
+			bindOne(1, a1);
+			bindOne(2, a2);
+			bindOne(3, a3);
+			bindOne(4, a4);
+			bindOne(5, a5);
+			bindOne(6, a6);
+			return *this;
+		}
+		template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7>
+		Stmt& bindAll(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5, const A6& a6, const A7& a7)
+		{
+			beginBind(7);
+			bindOne(1, a1);
+			bindOne(2, a2);
+			bindOne(3, a3);
+			bindOne(4, a4);
+			bindOne(5, a5);
+			bindOne(6, a6);
+			bindOne(7, a7);
+			return *this;
+		}
+		template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+		Stmt& bindAll(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5, const A6& a6, const A7& a7, const A8& a8)
+		{
+			beginBind(8);
+			bindOne(1, a1);
+			bindOne(2, a2);
+			bindOne(3, a3);
+			bindOne(4, a4);
+			bindOne(5, a5);
+			bindOne(6, a6);
+			bindOne(7, a7);
+			bindOne(8, a8);
+			return *this;
+		}
+
+		// Binds the arguments, steps once and resets
+		template<typename A1>
+		void execute(const A1& a1) { bindAll(a1); execute(); }
+		template<typename A1, typename A2>
+		void execute(const A1& a1, const A2& a2) { bindAll(a1, a2); execute(); }
+		template<typename A1, typename A2, typename A3>
+		void execute(const A1& a1, const A2& a2, const A3& a3) { bindAll(a1, a2, a3); execute(); }
+		template<typename A1, typename A2, typename A3, typename A4>
+		void execute(const A1& a1, const A2& a2, const A3& a3, const A4& a4) { bindAll(a1, a2, a3, a4); execute(); }
+		template<typename A1, typename A2, typename A3, typename A4, typename A5>
+		void execute(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5) { bindAll(a1, a2, a3, a4, a5); execute(); }
+		template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
+		void execute(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5, const A6& a6) { bindAll(a1, a2, a3, a4, a5, a6); execute(); }
+		template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7>
+		void execute(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5, const A6& a6, const A7& a7) { bindAll(a1, a2, a3, a4, a5, a6, a7); execute(); }
+		template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+		void execute(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5, const A6& a6, const A7& a7, const A8& a8) { bindAll(a1, a2, a3, a4, a5, a6, a7, a8); execute(); }
+
+		// Binds the arguments; iterate the rows with next()
+		template<typename A1>
+		Stmt& query(const A1& a1) { return bindAll(a1); }
+		template<typename A1, typename A2>
+		Stmt& query(const A1& a1, const A2& a2) { return bindAll(a1, a2); }
+		template<typename A1, typename A2, typename A3>
+		Stmt& query(const A1& a1, const A2& a2, const A3& a3) { return bindAll(a1, a2, a3); }
+		template<typename A1, typename A2, typename A3, typename A4>
+		Stmt& query(const A1& a1, const A2& a2, const A3& a3, const A4& a4) { return bindAll(a1, a2, a3, a4); }
+		template<typename A1, typename A2, typename A3, typename A4, typename A5>
+		Stmt& query(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5) { return bindAll(a1, a2, a3, a4, a5); }
+		template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
+		Stmt& query(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5, const A6& a6) { return bindAll(a1, a2, a3, a4, a5, a6); }
+		template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7>
+		Stmt& query(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5, const A6& a6, const A7& a7) { return bindAll(a1, a2, a3, a4, a5, a6, a7); }
+		template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+		Stmt& query(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5, const A6& a6, const A7& a7, const A8& a8) { return bindAll(a1, a2, a3, a4, a5, a6, a7, a8); }
+
+		const std::string& getQuery() const { return sql; }
 		const std::string& getTail() const { return tail; }
+		const unsigned getParamCount() const { return params; }
 
 		unsigned getRowCount();
 		unsigned getColumnCount();
 
 		bool next();
 		void execute() { next(); reset();}
+
+		Status tryNext();
+		Status tryExecute();
 		void executeMany(DataItr& dataProvider, Trans::TransactionType aType = Trans::DEFERRED);
 		void rewind() { reset(); }
 
 		Data value(unsigned idx);
 		Data operator[](unsigned idx) { return value(idx); }
+
+		Plan explainPlan();
+		StmtStatus getStatus(bool aReset = false);
+
+		// Interrupts runs (from the first next() after a reset until done)
+		// taking longer than aMs; 0 disables
+		void setTimeout(unsigned aMs) { timeout = aMs; }
+		unsigned getTimeout() const { return timeout; }
+
+		// Steps through all rows (from the start, with the current
+		// bindings) and resets. Read-only statements are answered from the
+		// owner's result cache when it is enabled.
+		ResultSet fetchAll();
 	};
 
 	class Finalizer
@@ -455,9 +1045,44 @@ namespace SQLite
 	AnsiString _cdecl amprintf(const char *, ...);
 #endif
 
+	// Debugging aid, see DB::setPlanChecker()
+	class PlanChecker
+	{
+	public:
+		// A statement was prepared whose plan contains a full table scan
+		// or a temporary b-tree
+		virtual void badPlan(Stmt& aStmt, const Plan& aPlan) = 0;
+		// A statement built automatic indexes while it ran; called
+		// right before it gets finalized, exceptions are ignored
+		virtual void autoIndexed(Stmt& aStmt, const StmtStatus& aStatus) = 0;
+	};
+
+	// Decides on the actions of statements being prepared, see
+	// sqlite3_set_authorizer(); returns SQLITE_OK, SQLITE_IGNORE or
+	// SQLITE_DENY
+	class Authorizer
+	{
+	public:
+		virtual int authorize(int aAction, const char *aArg1, const char *aArg2, const char *aDB, const char *aTrigger) = 0;
+	};
+
+	class ResultCache;
+	class ChangeStream;
+	class FormatCache;
+
 	class DB
 	{
 		friend class Stmt;
+		friend class Trans;
+		friend class Snapshot;
+		friend class ResultCache;
+		friend class ChangeStream;
+		friend class Session;
+		friend class Changeset;
+		friend class Checkpointer;
+		friend class Deadline;
+		friend class PrefetchCursor;
+		friend class MemoryDB;
 
 	private:
 		sqlite3 *ctx;
@@ -465,12 +1090,50 @@ namespace SQLite
 
 		typedef std::deque<Function*> FuncList;
 		FuncList funcs;
+		typedef std::deque<Tokenizer*> TokenizerList;
+		TokenizerList tokenizers;
+
+		PlanChecker *planChecker;
+		bool explaining;
+		Authorizer *authorizer;
+
+		ResultCache *cache;
+		ChangeStream *changes;
+		// open Sessions; they and a ChangeStream both need the preupdate hook
+		unsigned sessions;
+
+		// read-only images in use, by schema
+		typedef std::deque<std::pair<std::string, Image> > ImageList;
+		ImageList images;
+
+		__int64 deadline;
+		__int64 stmtDeadline;
+		bool timedOut;
+		int progressOps;
+		bool progressSet;
+
+		// statements for execute(const char*, ...), by format
+		FormatCache *formats;
+
+		void open(const char *aDB, const char *aVfs = NULL, int aFlags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+		void setHooks();
+		static void updateHook(void *aDB, int aOp, const char *aName, const char *aTable, sqlite3_int64 aRowid);
+		static int authorizerHook(void *aDB, int aAction, const char *aArg1, const char *aArg2, const char *aName, const char *aTrigger);
+		static int progressHandler(void *aDB);
+		void useProgressHandler();
+		void checkPlan(Stmt& aStmt);
+		void executeFormat(const char *aFormat, va_list ap);
+		void dropFormats();
 
-		void open(const char *aDB);
+	protected:
+		// sqlite3_open_v2() flags
+		DB(const std::string& aDB, int aFlags);
 
 	public:
 		explicit DB(const char *aDB);
 		explicit DB(const std::string& aDB);
+		// Opens aDB through the registered VFS aVfs, see StatsVfs
+		DB(const std::string& aDB, const std::string& aVfs);
 #ifdef __BORLANDC__
 		explicit DB(const AnsiString& aDB);
 #endif
@@ -488,24 +1151,787 @@ namespace SQLite
 
 #endif
 
+		// Formats like mprintf(). Formats using only %q (as '%q'), %Q, %d,
+		// %lld and %f are rewritten once into a statement with parameters
+		// that is kept and reused; anything else is formatted every time.
 		void __cdecl execute(const char *aQuery, ...);
 
+		// Like execute(), runs the first statement of aQuery only
+		Status tryExecute(const std::string &aQuery);
+
+		// The message of the last failed call on this connection, e.g.
+		// of a try*() call returning a failed Status
+		const char *getErrorMsg() const { return sqlite3_errmsg(ctx); }
+
 		const std::string& getDB() const { return db; }
 
 		void registerFunction(Function *aFunc);
+		// Makes aTokenizer available as tokenize='<name>' to FTS5 tables
+		void registerTokenizer(Tokenizer *aTokenizer);
+		// Registers vec_dot(a, b), vec_cosine(a, b) and vec_l2(a, b) on
+		// float32 blobs and the aggregate vec_topk(k, rowid, score), which
+		// returns the rowids of the k highest scores as a JSON array
+		void registerVectorFunctions();
+
+		// Makes aCompare available as COLLATE aName for ORDER BY, indexes
+		// and comparisons; see CollationAdapter
+		template<typename Compare>
+		void registerCollation(const std::string& aName, const Compare& aCompare)
+		{
+			Compare *compare = new Compare(aCompare);
+			if (SQLITE_OK != sqlite3_create_collation_v2(
+				ctx, aName.c_str(),
+				SQLITE_UTF8, compare,
+				&CollationAdapter<Compare>::compare,
+				&CollationAdapter<Compare>::destroy
+			))
+			{
+				// not destroyed by SQLite if registering failed
+				delete compare;
+				throw Exception(ctx);
+			}
+		}
+		// Plain functions, which would not bind to the template above
+		void registerCollation(const std::string& aName, CollationFunc aCompare)
+		{
+			registerCollation<CollationFunc>(aName, aCompare);
+		}
+		// Registers ASCII_NOCASE, NATURAL_ORDER and UTF8
+		void registerCollations();
 
 		__int64 lastInsertId() const ;
 
+		// A copy of aSchema as it would be stored on disk
+		Image serialize(const std::string& aSchema = "main");
+		// Replaces aSchema with the database in aImage. Read-only images
+		// are used in place, without copying, and kept alive while the
+		// connection is open; writable ones are copied.
+		void deserialize(const Image& aImage, bool aReadOnly = true, const std::string& aSchema = "main");
+
+		// Pages after which a committing writer checkpoints the WAL;
+		// 0 disables automatic checkpoints
+		void setAutoCheckpoint(int aPages);
+
+		// Interrupts whatever runs on this connection; may be called from
+		// any thread. Statements fail with Interrupted.
+		void cancel();
+		// Virtual machine instructions between deadline checks
+		void setProgressInterval(int aOpcodes);
+
+		// Checks the plan of every statement prepared from now on and
+		// reports suspicious ones; pass NULL to stop. Not owned.
+		void setPlanChecker(PlanChecker *aChecker) { planChecker = aChecker; }
+		// Authorizes the statements prepared from now on; pass NULL to
+		// stop. Not owned. Use this instead of sqlite3_set_authorizer(),
+		// the result cache shares the authorizer.
+		void setAuthorizer(Authorizer *aAuthorizer);
+
+		// Caches the results of Stmt::fetchAll() on read-only statements,
+		// keyed by the SQL with its bound parameters. Entries are dropped
+		// when a table they read is written on this connection, when any
+		// other connection commits (PRAGMA data_version), on schema changes
+		// and after aTtlMs (0 = no expiry). Statements prepared before
+		// enabling are not cached. Results read inside explicit
+		// transactions bypass the cache.
+		void enableCache(unsigned aMaxBytes, unsigned aTtlMs = 0);
+		void disableCache();
+		void clearCache();
+		CacheStats getCacheStats() const;
+
+		// aReset restarts the counters and high-water marks
+		DBStats stats(bool aReset = false);
+
+	};
+	// Interrupts statements on aDB still running aMs from now, until it
+	// goes out of scope. Nested deadlines never extend an outer one.
+	class Deadline
+	{
+	private:
+		DB& db;
+		__int64 previous;
+
+		Deadline(const Deadline&);
+		Deadline& operator=(const Deadline&);
+
+	public:
+		Deadline(DB& aDB, unsigned aMs);
+		~Deadline();
+	};
+
+	// Speeds up loading lots of rows into an FTS5 table by turning off
+	// incremental merges (automerge) and raising crisismerge while in
+	// scope. finish() merges the index into a single b-tree (optimize);
+	// the previous settings are restored either way. Settings the table
+	// did not have are removed again, except on connections with
+	// SQLITE_DBCONFIG_DEFENSIVE, which keep them at their default values.
+	class FtsBulkIndex
+	{
+	private:
+		DB& db;
+		std::string table;
+		int automerge;
+		int crisismerge;
+		// whether the table had the settings or used the defaults
+		bool hadAutomerge;
+		bool hadCrisismerge;
+		bool finished;
+
+		FtsBulkIndex(const FtsBulkIndex&);
+		FtsBulkIndex& operator=(const FtsBulkIndex&);
+
+		void configure(const char *aKey, int aValue);
+		void restore(const char *aKey, int aValue, bool aHad);
+		void restore();
+
+	public:
+		FtsBulkIndex(DB& aDB, const std::string& aTable, int aCrisisMerge = 64);
+		~FtsBulkIndex();
+
+		void finish();
+	};
+
+	// Loads rows unsorted in the input much faster than executeMany()
+	// into a table with indexes. The DataItr binds ?1..?N in the order of
+	// aColumns. Rows are sorted by the table's primary key, in parallel
+	// and spilling sorted runs to temporary files beyond the memory
+	// limit; the secondary indexes are dropped, the rows appended in key
+	// order and the indexes created again, all in one transaction.
+	class BulkLoad
+	{
+	private:
+		DB& db;
+		std::string table;
+		std::vector<std::string> columns;
+		unsigned memoryLimit;
+		unsigned threads;
+
+		BulkLoad(const BulkLoad&);
+		BulkLoad& operator=(const BulkLoad&);
+
+		unsigned loadSorted(DataItr& aData);
+		unsigned merge(DataItr& aData, unsigned aKey, Stmt& aInsert);
+
+	public:
+		BulkLoad(DB& aDB, const std::string& aTable, const std::vector<std::string>& aColumns);
+
+		// Bytes of rows kept in memory and of page cache; 64 MiB
+		void setMemoryLimit(unsigned aBytes) { memoryLimit = aBytes; }
+		// Sorting threads, also given to SQLite to build indexes; 4
+		void setThreads(unsigned aThreads) { threads = aThreads ? aThreads : 1; }
+
+		// Returns the number of rows loaded
+		unsigned load(DataItr& aData);
+	};
+
+	class IoStats
+	{
+	public:
+		__int64 reads;
+		__int64 writes;
+		__int64 syncs;
+		__int64 bytesRead;
+		__int64 bytesWritten;
+		__int64 readMicros;
+		__int64 writeMicros;
+		__int64 syncMicros;
+		// large reads filling the read-ahead buffer (also counted in
+		// reads) and reads served from it (not counted in reads)
+		__int64 readAheads;
+		__int64 readAheadHits;
+
+		IoStats()
+			: reads(0), writes(0), syncs(0), bytesRead(0), bytesWritten(0),
+			readMicros(0), writeMicros(0), syncMicros(0), readAheads(0), readAheadHits(0)
+		{}
+	};
+
+	class VfsStats
+	{
+	public:
+		IoStats db;
+		IoStats wal;
+		// rollback journals
+		IoStats journal;
+		// temporary files, sub-journals and the like
+		IoStats other;
+	};
+
+	class Mutex;
+	class IoCounters;
+
+	// A pass-through VFS that counts reads, writes and syncs, their bytes
+	// and latencies per file type. Open connections through it with
+	// DB(aDB, aName); it must outlive them. With aReadAhead, runs of
+	// sequential reads of a database file are served from a buffer
+	// filled by one large read, growing up to 1 MiB. The buffer is
+	// dropped whenever the connection's locks change or it writes.
+	class StatsVfs
+	{
+		friend class StatsVfsShim;
+
+	private:
+		std::string name;
+		sqlite3_vfs vfs;
+		sqlite3_vfs *parent;
+		bool readAhead;
+
+		// guards the list of open files and the counters of closed ones;
+		// open files count on their own
+		Mutex *mutex;
+		std::vector<IoCounters*> files;
+		VfsStats stats;
+
+		StatsVfs(const StatsVfs&);
+		StatsVfs& operator=(const StatsVfs&);
+
+	public:
+		// Wraps aParent, or the default VFS for NULL
+		explicit StatsVfs(const std::string& aName = "stats", bool aReadAhead = false, const char *aParent = NULL);
+		~StatsVfs();
+
+		const std::string& getName() const { return name; }
+
+		VfsStats getStats() const;
+		// Returns the counters and starts over
+		VfsStats resetStats();
 	};
+
 	class MemoryDB : public DB
 	{
 	public:
 		MemoryDB(): DB(":memory:") {}
+		// Starts out as the database in aImage, see DB::deserialize()
+		explicit MemoryDB(const Image& aImage, bool aReadOnly = true)
+			: DB(":memory:")
+		{
+			deserialize(aImage, aReadOnly);
+		}
+
+		// Replaces the contents with a writable copy of aSchema of aSource,
+		// copying the pages only once
+		void copyFrom(DB& aSource, const std::string& aSchema = "main");
 	};
 	class TempDB : public DB
 	{
 	public:
 		TempDB() : DB("") {}
 	};
+
+	typedef std::vector<DB*> ReaderList;
+
+	// Opens a database file that does not change while open (URI
+	// immutable=1): read-only, without file locks, journal checks or
+	// change detection, reading through a memory map of up to aMmapSize
+	// bytes. The connection has no mutex (SQLITE_OPEN_NOMUTEX), so only
+	// one thread may use it at a time; share the file with ReadOnlyPool.
+	class ImmutableDB : public DB
+	{
+	public:
+		explicit ImmutableDB(const std::string& aPath, __int64 aMmapSize = (__int64)1 << 30);
+	};
+
+	// Shares an immutable database file between threads. A Lease lends
+	// the calling thread a connection of its own; connections are opened
+	// on demand and kept for the next lease.
+	class ReadOnlyPool
+	{
+	private:
+		std::string path;
+		__int64 mmapSize;
+		std::vector<ImmutableDB*> all;
+		std::vector<ImmutableDB*> idle;
+		Mutex *mutex;
+
+		ReadOnlyPool(const ReadOnlyPool&);
+		ReadOnlyPool& operator=(const ReadOnlyPool&);
+
+		ImmutableDB *acquire();
+		void release(ImmutableDB *aDB);
+
+	public:
+		class Lease
+		{
+		private:
+			ReadOnlyPool& pool;
+			ImmutableDB *db;
+
+			Lease(const Lease&);
+			Lease& operator=(const Lease&);
+
+		public:
+			explicit Lease(ReadOnlyPool& aPool)
+				: pool(aPool), db(aPool.acquire())
+			{}
+			~Lease() { pool.release(db); }
+
+			DB& operator*() const { return *db; }
+			DB *operator->() const { return db; }
+		};
+
+		explicit ReadOnlyPool(const std::string& aPath, __int64 aMmapSize = (__int64)1 << 30);
+		~ReadOnlyPool();
+
+		// Opens connections up front until there are aCount
+		void reserve(unsigned aCount);
+		// Checks out aCount connections at once, e.g. for StatementRegistry;
+		// they are not leased until given back by releaseConnections()
+		ReaderList getConnections(unsigned aCount);
+		void releaseConnections(const ReaderList& aConnections);
+	};
+
+	// The kernel picked for this CPU by the vector functions:
+	// "avx2", "sse2" or "scalar"
+	const char *vectorKernel();
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+	// Pins a WAL snapshot of aSource (which keeps a read transaction open
+	// for the lifetime of the Snapshot) so that other connections may read
+	// the very same point in time.
+	class Snapshot
+	{
+	private:
+		DB& source;
+		std::string schema;
+		sqlite3_snapshot *snap;
+
+		Snapshot(const Snapshot&);
+		Snapshot& operator=(const Snapshot&);
+
+	public:
+		explicit Snapshot(DB& aSource, const std::string& aSchema = "main");
+		~Snapshot();
+
+		// Starts a read transaction on aReader positioned at the snapshot
+		void open(DB& aReader);
+		// Ends the read transaction started by open()
+		void close(DB& aReader);
+
+		DB& getSource() { return source; }
+		const std::string& getSchema() const { return schema; }
+	};
+
+	class RangeHandler
+	{
+	public:
+		// Called concurrently from one thread per reader
+		virtual void row(unsigned part, Stmt& aStmt) = 0;
+	};
+
+	// Splits aTable by rowid into one range per reader and runs aQuery
+	// (binding the inclusive lower and upper rowid to ?1 and ?2) on every
+	// reader in parallel, all of them reading aSnapshot.
+	void parallelScan(
+		Snapshot& aSnapshot,
+		ReaderList& readers,
+		const std::string& aTable,
+		const std::string& aQuery,
+		RangeHandler& handler
+		);
+#endif
+
+	// Named statements, declared once and prepared up front on every
+	// connection attached to the registry, so that the first requests
+	// do not pay for parsing. attach() fails fast, naming the first
+	// statement that does not match the schema.
+	class StatementRegistry
+	{
+	private:
+		typedef std::map<std::string, unsigned> NameMap;
+		NameMap names;
+		std::vector<std::string> queries;
+		std::vector<std::string> hot;
+
+		struct Connection
+		{
+			DB *db;
+			std::vector<Stmt*> stmts;
+		};
+		typedef std::vector<Connection*> ConnectionList;
+		ConnectionList connections;
+		Mutex *mutex;
+
+		StatementRegistry(const StatementRegistry&);
+		StatementRegistry& operator=(const StatementRegistry&);
+
+		Connection *find(DB& aDB) const;
+
+	public:
+		StatementRegistry();
+		~StatementRegistry();
+
+		// Declares aName; returns its id for get(). Only before attaching.
+		unsigned add(const std::string& aName, const std::string& aQuery);
+		// Marks a table or index to be read in full by warmup()
+		void addHot(const std::string& aTableOrIndex);
+
+		// Prepares every statement on aDB
+		void attach(DB& aDB);
+		// Prepares every statement on all of aPool, one thread per connection
+		void attach(ReaderList& aPool);
+		// Finalizes the statements of aDB
+		void detach(DB& aDB);
+
+		// The statement prepared on aDB (which must be attached), reset
+		Stmt& get(DB& aDB, unsigned aId);
+		Stmt& get(DB& aDB, const std::string& aName);
+
+		// Reads the hot tables and indexes on every attached connection,
+		// in parallel, to load their pages into the page caches
+		void warmup();
+		void warmup(DB& aDB);
+	};
+
+	class Change
+	{
+	public:
+		// SQLITE_INSERT, SQLITE_UPDATE or SQLITE_DELETE
+		int op;
+		std::string db;
+		std::string table;
+		// the old rowid, except for inserts
+		__int64 rowid;
+		__int64 newRowid;
+		// single rows; only captured when built with
+		// SQLITE_ENABLE_PREUPDATE_HOOK
+		ResultSet oldValues;
+		ResultSet newValues;
+
+		Change() : op(0), rowid(0), newRowid(0) {}
+	};
+	typedef std::vector<Change> ChangeList;
+
+	// Captures the row changes made through a DB. Changes are buffered per
+	// transaction and published to a bounded ring only once its commit
+	// succeeded, i.e. the step that committed returned; a failed commit
+	// keeps them for a retry while the transaction stays open. Rolled
+	// back changes are dropped, as are those of a statement that
+	// fails (a constraint ABORT undoes the statement, but not the
+	// transaction; with ON CONFLICT FAIL, the rows it kept are dropped as
+	// well). Partial ROLLBACK TO is not tracked.
+	// With SQLITE_ENABLE_PREUPDATE_HOOK it cannot share a DB with a
+	// Session, since only one preupdate hook can be installed: creating
+	// one while the other exists throws.
+	// The writing side never blocks: when the ring is full, changes are
+	// dropped and counted by getLost(). Consumers may drain from any thread.
+	class ChangeStream
+	{
+		friend class DB;
+		friend class Stmt;
+		friend class Changeset;
+
+	private:
+		DB& db;
+
+		std::vector<Change*> pending;
+		// handed over by the commit hook, until the commit returns
+		std::vector<Change*> committing;
+
+		Change **ring;
+		unsigned long mask;
+		volatile long head;
+		volatile long tail;
+		volatile long lost;
+		Mutex *consumers;
+
+		ChangeStream(const ChangeStream&);
+		ChangeStream& operator=(const ChangeStream&);
+
+		void capture(int aOp, const char *aName, const char *aTable, __int64 aRowid, __int64 aNewRowid);
+		void publish(std::vector<Change*>& aChanges);
+		static void discard(std::vector<Change*>& aChanges);
+		// called with the result of every step
+		void settle(int aStep);
+		unsigned mark() const { return (unsigned)pending.size(); }
+		void discardFrom(unsigned aMark);
+
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+		static void preupdateHook(void *aStream, sqlite3 *aCtx, int aOp, const char *aName, const char *aTable, sqlite3_int64 aRowid, sqlite3_int64 aNewRowid);
+#endif
+		static int commitHook(void *aStream);
+		static void rollbackHook(void *aStream);
+
+	public:
+		// aCapacity is rounded up to a power of two
+		explicit ChangeStream(DB& aDB, unsigned aCapacity = 4096);
+		~ChangeStream();
+
+		// Moves up to aMax (0 = all) published changes to aOut; returns
+		// the number of changes moved
+		unsigned drain(ChangeList& aOut, unsigned aMax = 0);
+
+		unsigned getLost() const { return (unsigned)lost; }
+	};
+
+#ifdef SQLITE_ENABLE_SESSION
+	class ConflictHandler
+	{
+	public:
+		// aConflict is one of SQLITE_CHANGESET_DATA, _NOTFOUND, _CONFLICT,
+		// _CONSTRAINT or _FOREIGN_KEY, aOp one of SQLITE_INSERT, _UPDATE
+		// or _DELETE. Return SQLITE_CHANGESET_OMIT, _REPLACE or _ABORT.
+		virtual int conflict(int aConflict, const char *aTable, int aOp) = 0;
+	};
+
+	class ChangesetWriter
+	{
+	public:
+		virtual void write(const void *aData, unsigned aLength) = 0;
+	};
+
+	// A changeset produced by a Session, as a binary blob
+	class Changeset
+	{
+	public:
+		// REPLACE overwrites conflicting rows and skips missing ones;
+		// constraint and foreign key violations always abort
+		enum ConflictPolicy {OMIT, REPLACE, ABORT};
+
+	private:
+		std::string data;
+
+	public:
+		Changeset() {}
+		Changeset(const void *aData, const unsigned aLength)
+			: data((const char*)aData, aLength)
+		{}
+
+		const void *getData() const { return data.data(); }
+		const unsigned getLength() const { return (unsigned)data.length(); }
+		bool empty() const { return data.empty(); }
+		operator Blob() const { return Blob(getData(), getLength()); }
+
+		// A changeset undoing this one
+		Changeset invert() const;
+		// Combines both changesets into one, as if applied one after another
+		Changeset& operator+=(const Changeset& c);
+
+		void apply(DB& aTarget, ConflictPolicy aPolicy = ABORT) const;
+		void apply(DB& aTarget, ConflictHandler& aHandler) const;
+	};
+
+	// Records the changes made to the attached tables of a DB. Cannot be
+	// created while a ChangeStream captures the DB (and vice versa), as
+	// both need the preupdate hook.
+	class Session
+	{
+	private:
+		DB& db;
+		sqlite3_session *session;
+
+		Session(const Session&);
+		Session& operator=(const Session&);
+
+	public:
+		explicit Session(DB& aDB, const std::string& aSchema = "main");
+		~Session();
+
+		// Tables need a PRIMARY KEY to be recorded
+		void attach(const std::string& aTable);
+		void attachAll();
+
+		void enable(bool aEnable);
+		bool isEmpty();
+
+		Changeset changeset();
+		Changeset patchset();
+		// Writes the changeset in chunks, without building it in memory
+		void changeset(ChangesetWriter& aWriter);
+	};
+#endif
+
+	class CheckpointPolicy
+	{
+	public:
+		// how often the WAL is looked at
+		unsigned intervalMs;
+		// RESTART once this much of the WAL could not be checkpointed
+		// passively, so that writers start over at its beginning
+		unsigned restartBytes;
+		// TRUNCATE once the WAL file reaches this size
+		unsigned truncateBytes;
+		// TRUNCATE once the WAL did not change for this long
+		unsigned idleMs;
+
+		CheckpointPolicy()
+			: intervalMs(1000), restartBytes(4 << 20), truncateBytes(64 << 20), idleMs(5000)
+		{}
+	};
+
+	class CheckpointStats
+	{
+	public:
+		unsigned checkpoints;
+		unsigned busy;
+		unsigned errors;
+		__int64 walBytes;
+		// frames in the WAL and checkpointed by the last run
+		int logFrames;
+		int checkpointedFrames;
+		__int64 totalFrames;
+		__int64 lastMicros;
+		__int64 maxMicros;
+		__int64 totalMicros;
+
+		CheckpointStats()
+			: checkpoints(0), busy(0), errors(0), walBytes(0), logFrames(0),
+			checkpointedFrames(0), totalFrames(0), lastMicros(0), maxMicros(0),
+			totalMicros(0)
+		{}
+	};
+
+	class Thread;
+	class Signal;
+
+	// Steps a statement on a separate thread, decoding up to aDepth rows
+	// ahead into a ring of reused row buffers, while the caller works on
+	// the current row. Handing rows over takes no locks unless one side
+	// has to wait for the other. The statement (and its connection) must
+	// not be used otherwise while the cursor lives; a Field is valid until
+	// the next call to next().
+	class PrefetchCursor
+	{
+		friend class PrefetchThread;
+
+	private:
+		Stmt& stmt;
+		unsigned columns;
+
+		ResultData **slots;
+		unsigned long mask;
+		volatile long head;
+		volatile long tail;
+		// the slot of the current row, NULL before the first next()
+		const ResultData *row;
+
+		volatile long finished;
+		volatile long stopping;
+		volatile long consumerWaiting;
+		volatile long producerWaiting;
+		Signal *produced;
+		Signal *consumed;
+		Thread *thread;
+
+		// set by the producer before it finishes
+		bool failed;
+		int errorCode;
+		bool timedOut;
+		std::string error;
+
+		PrefetchCursor(const PrefetchCursor&);
+		PrefetchCursor& operator=(const PrefetchCursor&);
+
+		void run();
+
+	public:
+		explicit PrefetchCursor(Stmt& aStmt, unsigned aDepth = 64);
+		~PrefetchCursor();
+
+		// Throws like Stmt::next() if the statement failed
+		bool next();
+
+		unsigned getColumnCount() const { return columns; }
+		Field value(unsigned col) const;
+		Field operator[](unsigned col) const { return value(col); }
+	};
+
+	// Checkpoints a WAL database from its own connection and thread, so
+	// application connections (see attach()) never stall on automatic
+	// checkpoints. Every interval a PASSIVE checkpoint runs; it is
+	// escalated according to the CheckpointPolicy.
+	class Checkpointer
+	{
+		friend class CheckpointThread;
+
+	public:
+		enum Mode {
+			PASSIVE = SQLITE_CHECKPOINT_PASSIVE,
+			FULL = SQLITE_CHECKPOINT_FULL,
+			RESTART = SQLITE_CHECKPOINT_RESTART,
+			TRUNCATE = SQLITE_CHECKPOINT_TRUNCATE
+		};
+
+	private:
+		DB *db;
+		std::string wal;
+		int pageSize;
+		CheckpointPolicy policy;
+
+		Thread *thread;
+		Signal *wake;
+		Mutex *mutex;
+		volatile long stopping;
+
+		CheckpointStats stats;
+		__int64 lastWalBytes;
+		int lastLogFrames;
+		__int64 unchangedSince;
+
+		Checkpointer(const Checkpointer&);
+		Checkpointer& operator=(const Checkpointer&);
+
+		void run();
+		void tick();
+		__int64 getWalBytes() const;
+
+	public:
+		explicit Checkpointer(const std::string& aPath, const CheckpointPolicy& aPolicy = CheckpointPolicy());
+		~Checkpointer();
+
+		// Disables automatic checkpoints on aDB
+		void attach(DB& aDB);
+
+		void start();
+		void stop();
+
+		// Checkpoints right away; returns false if SQLITE_BUSY
+		bool checkpoint(Mode aMode);
+
+		CheckpointStats getStats();
+	};
+
+	class StatsSink
+	{
+	public:
+		// aDelta holds the counters since the previous sample of aDB
+		virtual void connection(DB& aDB, const DBStats& aDelta) = 0;
+		virtual void library(const LibraryStats& aStats) = 0;
+	};
+
+	// Samples the attached connections and the library every interval
+	// from its own thread, passing them on to a StatsSink. Connections
+	// must not be opened with SQLITE_OPEN_NOMUTEX.
+	class StatsSampler
+	{
+		friend class SamplerThread;
+
+	private:
+		StatsSink& sink;
+		unsigned intervalMs;
+		std::vector<DB*> dbs;
+		std::vector<DBStats> last;
+
+		Thread *thread;
+		Signal *wake;
+		Mutex *mutex;
+		volatile long stopping;
+
+		StatsSampler(const StatsSampler&);
+		StatsSampler& operator=(const StatsSampler&);
+
+		void run();
+
+	public:
+		explicit StatsSampler(StatsSink& aSink, unsigned aIntervalMs = 1000);
+		~StatsSampler();
+
+		void attach(DB& aDB);
+		void detach(DB& aDB);
+
+		void start();
+		void stop();
+
+		// Samples right away, on the calling thread
+		void sample();
+	};
 }
 #endif
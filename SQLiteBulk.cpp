@@ -0,0 +1,589 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteCache.h"
+#include "SQLiteThread.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+
+using namespace std;
+
+namespace
+{
+	typedef SQLite::ResultData ResultData;
+	typedef ResultData::Cell Cell;
+
+	inline int rank(int aType)
+	{
+		switch (aType)
+		{
+			case SQLITE_NULL:
+				return 0;
+			case SQLITE_INTEGER:
+			case SQLITE_FLOAT:
+				return 1;
+			case SQLITE_TEXT:
+				return 2;
+			default:
+				return 3;
+		}
+	}
+
+	// The order SQLite gives values under the BINARY collation
+	int compareCells(const Cell& a, const char *aArena, const Cell& b, const char *bArena)
+	{
+		int ra = rank(a.type), rb = rank(b.type);
+		if (ra != rb)
+		{
+			return ra < rb ? -1 : 1;
+		}
+		switch (ra)
+		{
+			case 0:
+				return 0;
+			case 1:
+				if (a.type == SQLITE_INTEGER && b.type == SQLITE_INTEGER)
+				{
+					return a.i < b.i ? -1 : a.i > b.i;
+				}
+				return a.d < b.d ? -1 : a.d > b.d;
+			default:
+			{
+				int rv = memcmp(aArena + a.offset, bArena + b.offset, min(a.length, b.length));
+				if (rv)
+				{
+					return rv;
+				}
+				return a.length < b.length ? -1 : a.length > b.length;
+			}
+		}
+	}
+
+	// Rows of a sorted run, in memory or spilled to a temporary file
+	class Run
+	{
+	private:
+		Run(const Run&);
+		Run& operator=(const Run&);
+
+		bool readRow()
+		{
+			data.cells.clear();
+			data.arena.clear();
+			for (unsigned col = 0; col < data.columns; ++col)
+			{
+				Cell c;
+				if (fread(&c, sizeof(c), 1, file) != 1)
+				{
+					return false;
+				}
+				c.offset = (unsigned)data.arena.size();
+				if (c.type == SQLITE_TEXT || c.type == SQLITE_BLOB)
+				{
+					data.arena.resize(c.offset + c.length + 1);
+					if (fread(&data.arena[c.offset], 1, c.length + 1, file) != c.length + 1)
+					{
+						return false;
+					}
+				}
+				data.cells.push_back(c);
+			}
+			return true;
+		}
+
+	public:
+		ResultData data;
+		vector<unsigned> order;
+		unsigned rows;
+		FILE *file;
+		// position in the input, ties are merged in this order
+		unsigned index;
+
+		// the current row while merging
+		unsigned pos;
+		const Cell *cells;
+		const char *arena;
+
+		Run(unsigned aColumns, unsigned aIndex)
+			: data(aColumns), rows(0), file(NULL), index(aIndex), pos(0), cells(NULL), arena(NULL)
+		{}
+		~Run()
+		{
+			if (file)
+			{
+				fclose(file);
+			}
+		}
+
+		void sort(unsigned aKey);
+		void spill();
+
+		bool advance()
+		{
+			if (pos >= rows)
+			{
+				return false;
+			}
+			if (file)
+			{
+				if (!readRow())
+				{
+					throw SQLite::Exception("Cannot read bulk load run");
+				}
+				cells = &data.cells[0];
+			}
+			else
+			{
+				cells = &data.cells[order[pos] * data.columns];
+			}
+			arena = data.arena.data();
+			pos++;
+			return true;
+		}
+	};
+
+	class KeyLess
+	{
+	private:
+		const ResultData& data;
+		unsigned key;
+
+	public:
+		KeyLess(const ResultData& aData, unsigned aKey)
+			: data(aData), key(aKey)
+		{}
+		bool operator()(unsigned a, unsigned b) const
+		{
+			const char *arena = data.arena.data();
+			int rv = compareCells(data.cells[a * data.columns + key], arena, data.cells[b * data.columns + key], arena);
+			// keeps equal keys in input order
+			return rv ? rv < 0 : a < b;
+		}
+	};
+
+	void Run::sort(unsigned aKey)
+	{
+		order.resize(rows);
+		for (unsigned r = 0; r < rows; ++r)
+		{
+			order[r] = r;
+		}
+		std::sort(order.begin(), order.end(), KeyLess(data, aKey));
+	}
+
+	void Run::spill()
+	{
+		file = tmpfile();
+		if (!file)
+		{
+			throw SQLite::Exception("Cannot create bulk load run");
+		}
+		for (unsigned r = 0; r < rows; ++r)
+		{
+			const Cell *row = &data.cells[order[r] * data.columns];
+			for (unsigned col = 0; col < data.columns; ++col)
+			{
+				const Cell& c = row[col];
+				bool bytes = c.type == SQLITE_TEXT || c.type == SQLITE_BLOB;
+				if (fwrite(&c, sizeof(c), 1, file) != 1 ||
+					(bytes && fwrite(data.arena.data() + c.offset, 1, c.length + 1, file) != c.length + 1))
+				{
+					throw SQLite::Exception("Cannot write bulk load run");
+				}
+			}
+		}
+		if (fflush(file) || fseek(file, 0, SEEK_SET))
+		{
+			throw SQLite::Exception("Cannot write bulk load run");
+		}
+		vector<Cell>().swap(data.cells);
+		string().swap(data.arena);
+		vector<unsigned>().swap(order);
+	}
+
+	class SortThread : public SQLite::Thread
+	{
+	private:
+		Run& sorting;
+		unsigned key;
+		bool spilling;
+
+	public:
+		bool failed;
+		string error;
+
+		SortThread(Run& aRun, unsigned aKey, bool aSpill)
+			: sorting(aRun), key(aKey), spilling(aSpill), failed(false)
+		{}
+
+	protected:
+		virtual void run()
+		{
+			try
+			{
+				sorting.sort(key);
+				if (spilling)
+				{
+					sorting.spill();
+				}
+			}
+			catch (SQLite::Exception &ex)
+			{
+				failed = true;
+#ifdef __BORLANDC__
+				error = ex.Message.c_str();
+#else
+				error = ex.getErrorMsg();
+#endif
+			}
+			catch (...)
+			{
+				failed = true;
+				error = "Out of memory sorting bulk load run";
+			}
+		}
+	};
+
+	// Orders runs by their current rows, smallest on top of the heap
+	class RunGreater
+	{
+	private:
+		unsigned key;
+
+	public:
+		explicit RunGreater(unsigned aKey)
+			: key(aKey)
+		{}
+		bool operator()(const Run *a, const Run *b) const
+		{
+			int rv = compareCells(a->cells[key], a->arena, b->cells[key], b->arena);
+			// earlier runs hold earlier input
+			return rv ? rv > 0 : a->index > b->index;
+		}
+	};
+
+	void bindRow(SQLite::Stmt& aStmt, sqlite3_stmt *aRaw, const Run& aRun, unsigned aColumns)
+	{
+		for (unsigned col = 0; col < aColumns; ++col)
+		{
+			const Cell& c = aRun.cells[col];
+			int rv;
+			switch (c.type)
+			{
+				case SQLITE_INTEGER:
+					rv = sqlite3_bind_int64(aRaw, (int)col + 1, c.i);
+					break;
+				case SQLITE_FLOAT:
+					rv = sqlite3_bind_double(aRaw, (int)col + 1, c.d);
+					break;
+				case SQLITE_TEXT:
+					rv = sqlite3_bind_text(aRaw, (int)col + 1, aRun.arena + c.offset, (int)c.length, SQLITE_STATIC);
+					break;
+				case SQLITE_BLOB:
+					rv = sqlite3_bind_blob(aRaw, (int)col + 1, aRun.arena + c.offset, (int)c.length, SQLITE_STATIC);
+					break;
+				default:
+					rv = sqlite3_bind_null(aRaw, (int)col + 1);
+					break;
+			}
+			if (rv != SQLITE_OK)
+			{
+				throw SQLite::Exception(rv);
+			}
+		}
+		aStmt.execute();
+	}
+}
+
+namespace SQLite
+{
+	BulkLoad::BulkLoad(DB& aDB, const string& aTable, const vector<string>& aColumns)
+		: db(aDB), table(aTable), columns(aColumns), memoryLimit(64 << 20), threads(4)
+	{
+		if (columns.empty())
+		{
+			throw Exception("No columns to load");
+		}
+	}
+
+	unsigned BulkLoad::load(DataItr& aData)
+	{
+		int cacheSize;
+		{
+			Stmt stmt = db.prepare("PRAGMA cache_size");
+			stmt.next();
+			cacheSize = stmt[0];
+		}
+		int sqliteThreads;
+		{
+			Stmt stmt = db.prepare("PRAGMA threads");
+			stmt.next();
+			sqliteThreads = stmt[0];
+		}
+		// the page cache gets the same budget as the sort, in KiB
+		db.execute(mprintf("PRAGMA cache_size = %d", -(int)(memoryLimit >> 10)));
+		db.execute(mprintf("PRAGMA threads = %d", threads));
+
+		unsigned rows;
+		try
+		{
+			rows = loadSorted(aData);
+		}
+		catch (...)
+		{
+			try
+			{
+				db.execute(mprintf("PRAGMA cache_size = %d", cacheSize));
+				db.execute(mprintf("PRAGMA threads = %d", sqliteThreads));
+#ifdef __BORLANDC__
+			} catch (SQLite::Exception &ex) {
+#else
+			} catch (SQLite::Exception) {
+#endif
+			}
+			throw;
+		}
+		db.execute(mprintf("PRAGMA cache_size = %d", cacheSize));
+		db.execute(mprintf("PRAGMA threads = %d", sqliteThreads));
+		return rows;
+	}
+
+	unsigned BulkLoad::loadSorted(DataItr& aData)
+	{
+		Trans trans(db, Trans::IMMEDIATE);
+
+		// the first primary key column, if loaded, orders the rows
+		int key = -1;
+		{
+			Stmt info = db.prepare(mprintf("PRAGMA table_info(\"%w\")", table.c_str()));
+			while (info.next())
+			{
+				if ((int)info[5] != 1)
+				{
+					continue;
+				}
+				string name = info[1];
+				for (unsigned col = 0; col < columns.size(); ++col)
+				{
+					if (!sqlite3_stricmp(columns[col].c_str(), name.c_str()))
+					{
+						key = (int)col;
+					}
+				}
+			}
+		}
+
+		vector<string> indexes;
+		{
+			// automatic indexes (UNIQUE and PRIMARY KEY constraints) have no sql and stay
+			Stmt stmt = db.prepare("SELECT name, sql FROM sqlite_master WHERE type = 'index' AND tbl_name = ? AND sql NOT NULL");
+			stmt.bind(1, table);
+			vector<string> names;
+			while (stmt.next())
+			{
+				names.push_back(stmt[0]);
+				indexes.push_back(stmt[1]);
+			}
+			stmt.finalize();
+			for (unsigned i = 0; i < names.size(); ++i)
+			{
+				db.execute(mprintf("DROP INDEX \"%w\"", names[i].c_str()));
+			}
+		}
+
+		string sql = mprintf("INSERT INTO \"%w\"(", table.c_str());
+		string values;
+		for (unsigned col = 0; col < columns.size(); ++col)
+		{
+			if (col)
+			{
+				sql += ", ";
+				values += ", ";
+			}
+			sql += mprintf("\"%w\"", columns[col].c_str());
+			values += mprintf("?%u", col + 1);
+		}
+		Stmt insert = db.prepare(sql + ") VALUES(" + values + ")");
+
+		unsigned rows = 0;
+		if (key < 0)
+		{
+			while (aData.next())
+			{
+				aData.bind(insert);
+				insert.execute();
+				rows++;
+			}
+		}
+		else
+		{
+			rows = merge(aData, (unsigned)key, insert);
+		}
+		insert.finalize();
+
+		for (unsigned i = 0; i < indexes.size(); ++i)
+		{
+			db.execute(indexes[i]);
+		}
+		trans.commit();
+		return rows;
+	}
+
+	unsigned BulkLoad::merge(DataItr& aData, unsigned aKey, Stmt& aInsert)
+	{
+		const unsigned count = (unsigned)columns.size();
+		// several runs sort while the next one fills
+		const unsigned runBytes = max(memoryLimit / (2 * threads), 1u << 20);
+
+		string sql = "SELECT ";
+		for (unsigned col = 0; col < count; ++col)
+		{
+			sql += mprintf(col ? ", ?%u" : "?%u", col + 1);
+		}
+		Stmt staging = db.prepare(sql);
+
+		vector<Run*> runs;
+		deque<SortThread*> sorting;
+		unsigned rows = 0;
+		try
+		{
+			unsigned inMemory = 0;
+			Run *run = NULL;
+			for (;;)
+			{
+				bool more = aData.next();
+				if (more)
+				{
+					if (!run)
+					{
+						run = new Run(count, (unsigned)runs.size());
+						runs.push_back(run);
+					}
+					// the values exactly as the iterator binds them
+					aData.bind(staging);
+					staging.next();
+					run->data.append(staging.stmt);
+					staging.reset();
+					run->rows++;
+					rows++;
+				}
+				if (run && (!more || run->data.getSize() >= runBytes))
+				{
+					if (sorting.size() >= threads)
+					{
+						SortThread *oldest = sorting.front();
+						sorting.pop_front();
+						oldest->join();
+						bool failed = oldest->failed;
+						string error = oldest->error;
+						delete oldest;
+						if (failed)
+						{
+							throw Exception(error);
+						}
+					}
+					unsigned size = run->data.getSize();
+					bool spill = inMemory + size > memoryLimit;
+					if (!spill)
+					{
+						inMemory += size;
+					}
+					sorting.push_back(new SortThread(*run, aKey, spill));
+					sorting.back()->start();
+					run = NULL;
+				}
+				if (!more)
+				{
+					break;
+				}
+			}
+		}
+		catch (...)
+		{
+			for (unsigned i = 0; i < sorting.size(); ++i)
+			{
+				sorting[i]->join();
+				delete sorting[i];
+			}
+			for (unsigned i = 0; i < runs.size(); ++i)
+			{
+				delete runs[i];
+			}
+			throw;
+		}
+		staging.finalize();
+
+		string error;
+		for (unsigned i = 0; i < sorting.size(); ++i)
+		{
+			sorting[i]->join();
+			if (sorting[i]->failed && error.empty())
+			{
+				error = sorting[i]->error;
+			}
+			delete sorting[i];
+		}
+
+		try
+		{
+			if (!error.empty())
+			{
+				throw Exception(error);
+			}
+			sqlite3_stmt *raw = aInsert.stmt;
+			RunGreater greater(aKey);
+			vector<Run*> heap;
+			for (unsigned i = 0; i < runs.size(); ++i)
+			{
+				if (runs[i]->advance())
+				{
+					heap.push_back(runs[i]);
+				}
+			}
+			make_heap(heap.begin(), heap.end(), greater);
+			while (!heap.empty())
+			{
+				pop_heap(heap.begin(), heap.end(), greater);
+				Run *top = heap.back();
+				bindRow(aInsert, raw, *top, count);
+				if (top->advance())
+				{
+					push_heap(heap.begin(), heap.end(), greater);
+				}
+				else
+				{
+					heap.pop_back();
+				}
+			}
+			sqlite3_clear_bindings(raw);
+		}
+		catch (...)
+		{
+			sqlite3_clear_bindings(aInsert.stmt);
+			for (unsigned i = 0; i < runs.size(); ++i)
+			{
+				delete runs[i];
+			}
+			throw;
+		}
+		for (unsigned i = 0; i < runs.size(); ++i)
+		{
+			delete runs[i];
+		}
+		return rows;
+	}
+}
@@ -0,0 +1,403 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteCache.h"
+#include "SQLiteCheck.h"
+#include "SQLiteThread.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace SQLite
+{
+	void ResultData::append(sqlite3_stmt *aStmt)
+	{
+		for (unsigned col = 0; col < columns; ++col)
+		{
+			Cell c;
+			c.type = sqlite3_column_type(aStmt, (int)col);
+			c.offset = (unsigned)arena.size();
+			c.length = 0;
+			if (c.type == SQLITE_BLOB)
+			{
+				c.length = (unsigned)sqlite3_column_bytes(aStmt, (int)col);
+				arena.append((const char*)sqlite3_column_blob(aStmt, (int)col), c.length);
+				arena.push_back('\0');
+			}
+			else if (c.type != SQLITE_NULL)
+			{
+				// text first; the numeric conversions below keep it valid
+				const char *text = (const char*)sqlite3_column_text(aStmt, (int)col);
+				c.length = (unsigned)sqlite3_column_bytes(aStmt, (int)col);
+				arena.append(text, c.length);
+				arena.push_back('\0');
+			}
+			c.i = sqlite3_column_int64(aStmt, (int)col);
+			c.d = sqlite3_column_double(aStmt, (int)col);
+			cells.push_back(c);
+		}
+	}
+
+	void ResultData::append(sqlite3_value *aValue)
+	{
+		Cell c;
+		c.type = sqlite3_value_type(aValue);
+		c.offset = (unsigned)arena.size();
+		c.length = 0;
+		if (c.type == SQLITE_BLOB)
+		{
+			c.length = (unsigned)sqlite3_value_bytes(aValue);
+			arena.append((const char*)sqlite3_value_blob(aValue), c.length);
+			arena.push_back('\0');
+		}
+		else if (c.type != SQLITE_NULL)
+		{
+			const char *text = (const char*)sqlite3_value_text(aValue);
+			c.length = (unsigned)sqlite3_value_bytes(aValue);
+			arena.append(text, c.length);
+			arena.push_back('\0');
+		}
+		c.i = sqlite3_value_int64(aValue);
+		c.d = sqlite3_value_double(aValue);
+		cells.push_back(c);
+	}
+
+	void ResultData::appendNull()
+	{
+		Cell c;
+		c.type = SQLITE_NULL;
+		c.offset = (unsigned)arena.size();
+		c.length = 0;
+		c.i = 0;
+		c.d = 0.0;
+		cells.push_back(c);
+	}
+
+	int Field::asInt() const { return (int)data->cells[cell].i; }
+	__int64 Field::asInt64() const { return data->cells[cell].i; }
+	double Field::asDouble() const { return data->cells[cell].d; }
+	const char *Field::asChar() const
+	{
+		const ResultData::Cell& c = data->cells[cell];
+		return c.type == SQLITE_NULL ? NULL : data->arena.data() + c.offset;
+	}
+	string Field::asString() const
+	{
+		const ResultData::Cell& c = data->cells[cell];
+		return string(data->arena.data() + c.offset, c.length);
+	}
+#ifdef __BORLANDC__
+	AnsiString Field::asAString() const
+	{
+		const ResultData::Cell& c = data->cells[cell];
+		return AnsiString(data->arena.data() + c.offset, c.length);
+	}
+#endif
+	Blob Field::asBlob() const
+	{
+		const ResultData::Cell& c = data->cells[cell];
+		return Blob(c.type == SQLITE_NULL ? NULL : data->arena.data() + c.offset, c.length);
+	}
+	int Field::getType() const { return data->cells[cell].type; }
+
+	ResultSet::ResultSet()
+		: data(NULL)
+	{}
+	ResultSet::ResultSet(ResultData *aData)
+		: data(aData)
+	{}
+	ResultSet::ResultSet(const ResultSet &c)
+		: data(c.data)
+	{
+		if (data)
+		{
+			atomicAdd(&data->refs, 1);
+		}
+	}
+	ResultSet::~ResultSet()
+	{
+		if (data && atomicAdd(&data->refs, -1) == 0)
+		{
+			delete data;
+		}
+	}
+	ResultSet& ResultSet::operator=(const ResultSet &c)
+	{
+		if (c.data)
+		{
+			atomicAdd(&c.data->refs, 1);
+		}
+		if (data && atomicAdd(&data->refs, -1) == 0)
+		{
+			delete data;
+		}
+		data = c.data;
+		return *this;
+	}
+	unsigned ResultSet::getRowCount() const
+	{
+		if (!data || !data->columns)
+		{
+			return 0;
+		}
+		return (unsigned)data->cells.size() / data->columns;
+	}
+	unsigned ResultSet::getColumnCount() const
+	{
+		return data ? data->columns : 0;
+	}
+	unsigned ResultSet::getSize() const
+	{
+		return data ? data->getSize() : 0;
+	}
+	Field ResultSet::value(unsigned row, unsigned col) const
+	{
+#ifndef NDEBUG
+		if (row >= getRowCount() || col >= getColumnCount())
+		{
+			throw Exception("Invalid Field");
+		}
+#endif
+		return Field(data, row * data->columns + col);
+	}
+
+	ResultCache::ResultCache(DB& aDB, unsigned aMaxBytes, unsigned aTtlMs)
+		: db(aDB), maxBytes(aMaxBytes), ttl((__int64)aTtlMs * 1000),
+		version(NULL), dataVersion(0), flush(false), hookedChanges(0),
+		totalChanges(sqlite3_total_changes(aDB.ctx)), collecting(NULL)
+	{
+		version = new Stmt(db.prepare("PRAGMA data_version"));
+		if (version->next())
+		{
+			dataVersion = (*version)[0];
+		}
+		version->reset();
+	}
+	ResultCache::~ResultCache()
+	{
+		delete version;
+	}
+
+	void ResultCache::authorize(int aAction, const char *aArg1)
+	{
+		switch (aAction)
+		{
+		case SQLITE_READ:
+			if (collecting && aArg1)
+			{
+				collecting->push_back(aArg1);
+			}
+			break;
+		case SQLITE_CREATE_INDEX:
+		case SQLITE_CREATE_TABLE:
+		case SQLITE_CREATE_TEMP_INDEX:
+		case SQLITE_CREATE_TEMP_TABLE:
+		case SQLITE_CREATE_TEMP_TRIGGER:
+		case SQLITE_CREATE_TEMP_VIEW:
+		case SQLITE_CREATE_TRIGGER:
+		case SQLITE_CREATE_VIEW:
+		case SQLITE_DROP_INDEX:
+		case SQLITE_DROP_TABLE:
+		case SQLITE_DROP_TEMP_INDEX:
+		case SQLITE_DROP_TEMP_TABLE:
+		case SQLITE_DROP_TEMP_TRIGGER:
+		case SQLITE_DROP_TEMP_VIEW:
+		case SQLITE_DROP_TRIGGER:
+		case SQLITE_DROP_VIEW:
+		case SQLITE_ATTACH:
+		case SQLITE_DETACH:
+		case SQLITE_ALTER_TABLE:
+		case SQLITE_CREATE_VTABLE:
+		case SQLITE_DROP_VTABLE:
+			flush = true;
+			break;
+		}
+	}
+
+	void ResultCache::validate()
+	{
+		// changes the update hook does not see, e.g. WITHOUT ROWID tables
+		int total = sqlite3_total_changes(db.ctx);
+		if ((unsigned)(total - totalChanges) > hookedChanges)
+		{
+			flush = true;
+		}
+		totalChanges = total;
+		hookedChanges = 0;
+
+		// commits of other connections
+		if (version->next())
+		{
+			__int64 v = (*version)[0];
+			if (v != dataVersion)
+			{
+				dataVersion = v;
+				flush = true;
+			}
+		}
+		version->reset();
+
+		if (flush)
+		{
+			stats.invalidations += (unsigned)entries.size();
+			clear();
+			return;
+		}
+		if (dirty.empty())
+		{
+			return;
+		}
+		for (EntryMap::iterator i = entries.begin(), e = entries.end(); i != e;)
+		{
+			EntryMap::iterator cur = i++;
+			const vector<string>& tables = cur->second.tables;
+			for (vector<string>::const_iterator t = tables.begin(), te = tables.end(); t != te; ++t)
+			{
+				if (dirty.find(*t) != dirty.end())
+				{
+					erase(cur);
+					stats.invalidations++;
+					break;
+				}
+			}
+		}
+		dirty.clear();
+	}
+	void ResultCache::erase(EntryMap::iterator aEntry)
+	{
+		stats.bytes -= aEntry->second.size;
+		stats.entries--;
+		lru.erase(aEntry->second.lru);
+		entries.erase(aEntry);
+	}
+	void ResultCache::clear()
+	{
+		entries.clear();
+		lru.clear();
+		dirty.clear();
+		flush = false;
+		stats.entries = stats.bytes = 0;
+	}
+
+	bool ResultCache::lookup(const string& aKey, ResultSet& aResult)
+	{
+		validate();
+		EntryMap::iterator i = entries.find(aKey);
+		if (i == entries.end())
+		{
+			stats.misses++;
+			return false;
+		}
+		if (ttl && clockMicros() - i->second.created > ttl)
+		{
+			erase(i);
+			stats.expirations++;
+			stats.misses++;
+			return false;
+		}
+		lru.splice(lru.begin(), lru, i->second.lru);
+		aResult = i->second.result;
+		stats.hits++;
+		return true;
+	}
+	void ResultCache::store(const string& aKey, const vector<string>& aTables, const ResultSet& aResult)
+	{
+		unsigned size = aResult.getSize() + (unsigned)aKey.size();
+		if (size > maxBytes)
+		{
+			return;
+		}
+		EntryMap::iterator i = entries.find(aKey);
+		if (i != entries.end())
+		{
+			erase(i);
+		}
+		while (stats.bytes + size > maxBytes && !lru.empty())
+		{
+			erase(entries.find(lru.back()));
+			stats.evictions++;
+		}
+
+		Entry& entry = entries[aKey];
+		entry.result = aResult;
+		entry.tables = aTables;
+		entry.created = clockMicros();
+		entry.size = size;
+		entry.lru = lru.insert(lru.begin(), aKey);
+		stats.bytes += size;
+		stats.entries++;
+	}
+
+	ResultSet Stmt::fetchAll()
+	{
+		CHKTHROW
+		string key;
+		if (owner.cache && tracked && sqlite3_stmt_readonly(stmt) && sqlite3_get_autocommit(owner.ctx))
+		{
+			// the exact values; the expanded SQL rounds doubles
+			key.assign(sql);
+			key.push_back('\0');
+			for (unsigned i = 0; i < bindings.size(); ++i)
+			{
+				key += bindings[i];
+				key.push_back('\0');
+			}
+		}
+
+		ResultSet rv;
+		if (!key.empty() && owner.cache->lookup(key, rv))
+		{
+			return rv;
+		}
+
+		reset();
+		rv = ResultSet(new ResultData(getColumnCount()));
+		while (next())
+		{
+			rv.data->append(stmt);
+		}
+		reset();
+
+		if (!key.empty())
+		{
+			owner.cache->store(key, reads, rv);
+		}
+		return rv;
+	}
+
+	void DB::enableCache(unsigned aMaxBytes, unsigned aTtlMs)
+	{
+		disableCache();
+		cache = new ResultCache(*this, aMaxBytes, aTtlMs);
+		setHooks();
+	}
+	void DB::disableCache()
+	{
+		delete cache;
+		cache = NULL;
+		setHooks();
+	}
+	void DB::clearCache()
+	{
+		if (cache)
+		{
+			cache->clear();
+		}
+	}
+	CacheStats DB::getCacheStats() const
+	{
+		return cache ? cache->getStats() : CacheStats();
+	}
+}
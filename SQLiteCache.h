@@ -0,0 +1,129 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+/* $Id$ */
+
+/*
+** Internals of the result cache (DB::enableCache). Not part of the
+** public interface; include SQLite.h instead.
+*/
+
+#ifndef _SQLITEPP_CACHE_H
+#define _SQLITEPP_CACHE_H
+
+#ifdef MSVC
+#pragma once
+#endif
+
+#include "SQLite.h"
+
+#include <map>
+#include <list>
+#include <set>
+
+namespace SQLite
+{
+	class ResultData
+	{
+	public:
+		struct Cell
+		{
+			__int64 i;
+			double d;
+			unsigned offset;
+			unsigned length;
+			int type;
+		};
+
+		volatile long refs;
+		unsigned columns;
+		std::vector<Cell> cells;
+		// text and blob bytes of all cells, each NUL terminated
+		std::string arena;
+
+		explicit ResultData(unsigned aColumns)
+			: refs(1), columns(aColumns)
+		{}
+
+		void append(sqlite3_stmt *aStmt);
+		void append(sqlite3_value *aValue);
+		void appendNull();
+		unsigned getSize() const
+		{
+			return (unsigned)(sizeof(*this) + cells.size() * sizeof(Cell) + arena.size());
+		}
+	};
+
+	class ResultCache
+	{
+	private:
+		typedef std::list<std::string> LruList;
+		typedef std::set<std::string> TableSet;
+		struct Entry
+		{
+			ResultSet result;
+			std::vector<std::string> tables;
+			__int64 created;
+			unsigned size;
+			LruList::iterator lru;
+		};
+		typedef std::map<std::string, Entry> EntryMap;
+
+		DB& db;
+		unsigned maxBytes;
+		__int64 ttl;
+
+		EntryMap entries;
+		// most recently used first
+		LruList lru;
+		CacheStats stats;
+
+		Stmt *version;
+		__int64 dataVersion;
+
+		TableSet dirty;
+		bool flush;
+		unsigned hookedChanges;
+		int totalChanges;
+
+		std::vector<std::string> *collecting;
+
+		ResultCache(const ResultCache&);
+		ResultCache& operator=(const ResultCache&);
+
+		void validate();
+		void erase(EntryMap::iterator aEntry);
+
+	public:
+		ResultCache(DB& aDB, unsigned aMaxBytes, unsigned aTtlMs);
+		~ResultCache();
+
+		// Records the tables read by statements prepared until called
+		// again with NULL
+		void collect(std::vector<std::string> *aReads) { collecting = aReads; }
+		// Called by the owner's authorizer
+		void authorize(int aAction, const char *aArg1);
+		// Called by the owner's update hook
+		void tableChanged(const char *aTable)
+		{
+			dirty.insert(aTable);
+			hookedChanges++;
+		}
+
+		bool lookup(const std::string& aKey, ResultSet& aResult);
+		void store(const std::string& aKey, const std::vector<std::string>& aTables, const ResultSet& aResult);
+		void clear();
+
+		const CacheStats& getStats() const { return stats; }
+	};
+}
+#endif
@@ -0,0 +1,220 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteCache.h"
+#include "SQLiteThread.h"
+
+using namespace std;
+
+namespace SQLite
+{
+	ChangeStream::ChangeStream(DB& aDB, unsigned aCapacity)
+		: db(aDB), ring(NULL), mask(0), head(0), tail(0), lost(0), consumers(NULL)
+	{
+		if (db.changes)
+		{
+			throw Exception("Changes are already captured");
+		}
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+		if (db.sessions)
+		{
+			throw Exception("Cannot capture changes while a session records");
+		}
+#endif
+
+		unsigned long capacity = 1;
+		while (capacity < aCapacity)
+		{
+			capacity <<= 1;
+		}
+		mask = capacity - 1;
+		ring = new Change*[capacity];
+		consumers = new Mutex();
+
+		db.changes = this;
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+		sqlite3_preupdate_hook(db.ctx, preupdateHook, this);
+#endif
+		sqlite3_commit_hook(db.ctx, commitHook, this);
+		sqlite3_rollback_hook(db.ctx, rollbackHook, this);
+		db.setHooks();
+	}
+	ChangeStream::~ChangeStream()
+	{
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+		sqlite3_preupdate_hook(db.ctx, NULL, NULL);
+#endif
+		sqlite3_commit_hook(db.ctx, NULL, NULL);
+		sqlite3_rollback_hook(db.ctx, NULL, NULL);
+		db.changes = NULL;
+		db.setHooks();
+
+		discard(pending);
+		discard(committing);
+		for (long i = tail; i != head; ++i)
+		{
+			delete ring[(unsigned long)i & mask];
+		}
+		delete [] ring;
+		delete consumers;
+	}
+
+	void ChangeStream::capture(int aOp, const char *aName, const char *aTable, __int64 aRowid, __int64 aNewRowid)
+	{
+		Change *change = new Change();
+		change->op = aOp;
+		change->db = aName;
+		change->table = aTable;
+		change->rowid = aOp == SQLITE_INSERT ? aNewRowid : aRowid;
+		change->newRowid = aNewRowid;
+		pending.push_back(change);
+	}
+
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+	void ChangeStream::preupdateHook(void *aStream, sqlite3 *aCtx, int aOp, const char *aName, const char *aTable, sqlite3_int64 aRowid, sqlite3_int64 aNewRowid)
+	{
+		ChangeStream *stream = reinterpret_cast<ChangeStream*>(aStream);
+		stream->capture(aOp, aName, aTable, aRowid, aNewRowid);
+		Change *change = stream->pending.back();
+
+		int count = sqlite3_preupdate_count(aCtx);
+		sqlite3_value *value;
+		if (aOp != SQLITE_INSERT)
+		{
+			ResultData *data = new ResultData((unsigned)count);
+			change->oldValues = ResultSet(data);
+			for (int i = 0; i < count; ++i)
+			{
+				if (sqlite3_preupdate_old(aCtx, i, &value) == SQLITE_OK)
+				{
+					data->append(value);
+				}
+				else
+				{
+					data->appendNull();
+				}
+			}
+		}
+		if (aOp != SQLITE_DELETE)
+		{
+			ResultData *data = new ResultData((unsigned)count);
+			change->newValues = ResultSet(data);
+			for (int i = 0; i < count; ++i)
+			{
+				if (sqlite3_preupdate_new(aCtx, i, &value) == SQLITE_OK)
+				{
+					data->append(value);
+				}
+				else
+				{
+					data->appendNull();
+				}
+			}
+		}
+	}
+#endif
+
+	int ChangeStream::commitHook(void *aStream)
+	{
+		// the commit may still fail, see settle()
+		ChangeStream *stream = reinterpret_cast<ChangeStream*>(aStream);
+		stream->committing.insert(stream->committing.end(), stream->pending.begin(), stream->pending.end());
+		stream->pending.clear();
+		return 0;
+	}
+	void ChangeStream::rollbackHook(void *aStream)
+	{
+		discard(reinterpret_cast<ChangeStream*>(aStream)->pending);
+	}
+
+	void ChangeStream::settle(int aStep)
+	{
+		if (committing.empty())
+		{
+			return;
+		}
+		if (aStep == SQLITE_DONE || aStep == SQLITE_ROW)
+		{
+			publish(committing);
+		}
+		else if (!sqlite3_get_autocommit(db.ctx))
+		{
+			// still open, e.g. a COMMIT that got SQLITE_BUSY; the next
+			// commit takes them along
+			pending.insert(pending.begin(), committing.begin(), committing.end());
+			committing.clear();
+		}
+		else
+		{
+			discard(committing);
+		}
+	}
+
+	void ChangeStream::publish(vector<Change*>& aChanges)
+	{
+		// single producer: only this thread ever moves head
+		long h = head;
+		for (vector<Change*>::iterator i = aChanges.begin(), e = aChanges.end(); i != e; ++i)
+		{
+			if ((unsigned long)(h - atomicGet(&tail)) > mask)
+			{
+				delete *i;
+				atomicAdd(&lost, 1);
+				continue;
+			}
+			ring[(unsigned long)h & mask] = *i;
+			h = (long)((unsigned long)h + 1);
+		}
+		atomicSet(&head, h);
+		aChanges.clear();
+	}
+	void ChangeStream::discard(vector<Change*>& aChanges)
+	{
+		for (vector<Change*>::iterator i = aChanges.begin(), e = aChanges.end(); i != e; ++i)
+		{
+			delete *i;
+		}
+		aChanges.clear();
+	}
+
+	void ChangeStream::discardFrom(unsigned aMark)
+	{
+		for (unsigned i = aMark; i < pending.size(); ++i)
+		{
+			delete pending[i];
+		}
+		if (aMark < pending.size())
+		{
+			pending.resize(aMark);
+		}
+	}
+
+	unsigned ChangeStream::drain(ChangeList& aOut, unsigned aMax)
+	{
+		Lock lock(*consumers);
+		long t = tail;
+		long h = atomicGet(&head);
+		unsigned rv = 0;
+		while (t != h && (!aMax || rv < aMax))
+		{
+			Change *change = ring[(unsigned long)t & mask];
+			aOut.push_back(*change);
+			delete change;
+			t = (long)((unsigned long)t + 1);
+			++rv;
+		}
+		atomicSet(&tail, t);
+		return rv;
+	}
+}
@@ -0,0 +1,33 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+/* $Id$ */
+
+/*
+** Debug checks shared by the Stmt members spread over several files.
+** Not part of the public interface; include SQLite.h instead.
+*/
+
+#ifndef _SQLITEPP_CHECK_H
+#define _SQLITEPP_CHECK_H
+
+#ifdef MSVC
+#pragma once
+#endif
+
+#ifndef NDEBUG
+#	define CHKTHROW if (!ok) { throw Exception("Statement unprepared!"); }
+#else
+#	define CHKTHROW
+#endif
+
+#endif
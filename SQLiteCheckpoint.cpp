@@ -0,0 +1,243 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteThread.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace SQLite
+{
+	class CheckpointThread : public Thread
+	{
+	private:
+		Checkpointer& owner;
+
+	public:
+		explicit CheckpointThread(Checkpointer& aOwner)
+			: owner(aOwner)
+		{}
+
+	protected:
+		virtual void run() { owner.run(); }
+	};
+
+	Checkpointer::Checkpointer(const string& aPath, const CheckpointPolicy& aPolicy)
+		: db(NULL), pageSize(4096), policy(aPolicy), thread(NULL), wake(NULL),
+		mutex(NULL), stopping(0), lastWalBytes(0), lastLogFrames(0),
+		unchangedSince(0)
+	{
+		db = new DB(aPath);
+		try
+		{
+			db->setAutoCheckpoint(0);
+			Stmt stmt = db->prepare("PRAGMA page_size");
+			if (stmt.next())
+			{
+				pageSize = stmt[0];
+			}
+			stmt.finalize();
+
+			const char *file = sqlite3_db_filename(db->ctx, "main");
+			if (!file || !*file)
+			{
+				throw Exception("Cannot checkpoint a temporary database");
+			}
+			wal.assign(file);
+			wal.append("-wal");
+		}
+		catch (...)
+		{
+			delete db;
+			throw;
+		}
+		wake = new Signal();
+		mutex = new Mutex();
+		unchangedSince = clockMicros();
+	}
+	Checkpointer::~Checkpointer()
+	{
+		stop();
+		delete mutex;
+		delete wake;
+		delete db;
+	}
+
+	void Checkpointer::attach(DB& aDB)
+	{
+		aDB.setAutoCheckpoint(0);
+	}
+
+	void Checkpointer::start()
+	{
+		if (thread)
+		{
+			return;
+		}
+		atomicSet(&stopping, 0);
+		thread = new CheckpointThread(*this);
+		try
+		{
+			thread->start();
+		}
+		catch (...)
+		{
+			delete thread;
+			thread = NULL;
+			throw;
+		}
+	}
+	void Checkpointer::stop()
+	{
+		if (!thread)
+		{
+			return;
+		}
+		atomicSet(&stopping, 1);
+		wake->set();
+		thread->join();
+		delete thread;
+		thread = NULL;
+	}
+
+	void Checkpointer::run()
+	{
+		while (!atomicGet(&stopping))
+		{
+			wake->wait(policy.intervalMs);
+			if (atomicGet(&stopping))
+			{
+				break;
+			}
+			try
+			{
+				tick();
+			}
+			catch (...)
+			{
+				// counted by checkpoint(), the only call of tick() that throws
+			}
+		}
+	}
+
+	__int64 Checkpointer::getWalBytes() const
+	{
+		struct stat st;
+		if (stat(wal.c_str(), &st) != 0)
+		{
+			return 0;
+		}
+		return (__int64)st.st_size;
+	}
+
+	void Checkpointer::tick()
+	{
+		__int64 walBytes = getWalBytes();
+		{
+			Lock lock(*mutex);
+			stats.walBytes = walBytes;
+		}
+		if (!walBytes)
+		{
+			return;
+		}
+
+		checkpoint(PASSIVE);
+
+		int logFrames, checkpointed;
+		{
+			Lock lock(*mutex);
+			logFrames = stats.logFrames;
+			checkpointed = stats.checkpointedFrames;
+		}
+
+		__int64 now = clockMicros();
+		if (walBytes != lastWalBytes || logFrames != lastLogFrames)
+		{
+			lastWalBytes = walBytes;
+			lastLogFrames = logFrames;
+			unchangedSince = now;
+		}
+		bool idle = now - unchangedSince >= (__int64)policy.idleMs * 1000;
+
+		if (walBytes >= (__int64)policy.truncateBytes || idle)
+		{
+			if (checkpoint(TRUNCATE))
+			{
+				lastWalBytes = getWalBytes();
+				Lock lock(*mutex);
+				stats.walBytes = lastWalBytes;
+			}
+		}
+		else if ((__int64)(logFrames - checkpointed) * pageSize >= (__int64)policy.restartBytes)
+		{
+			checkpoint(RESTART);
+		}
+	}
+
+	bool Checkpointer::checkpoint(Mode aMode)
+	{
+		int logFrames = 0, checkpointed = 0;
+		__int64 start = clockMicros();
+		int rc = sqlite3_wal_checkpoint_v2(db->ctx, NULL, (int)aMode, &logFrames, &checkpointed);
+		if (rc == SQLITE_OK && logFrames < 0)
+		{
+			// the connection only notices WAL mode once it reads
+			db->tryExecute("SELECT 1 FROM sqlite_master LIMIT 1");
+			rc = sqlite3_wal_checkpoint_v2(db->ctx, NULL, (int)aMode, &logFrames, &checkpointed);
+		}
+		__int64 elapsed = clockMicros() - start;
+
+		Lock lock(*mutex);
+		if (rc == SQLITE_BUSY)
+		{
+			stats.busy++;
+			return false;
+		}
+		if (rc != SQLITE_OK)
+		{
+			stats.errors++;
+			throw Exception(rc);
+		}
+		stats.checkpoints++;
+		// counts are -1 when the database is not in WAL mode
+		if (checkpointed > 0)
+		{
+			int fresh = checkpointed;
+			// the counts restart along with the WAL
+			if (checkpointed >= stats.checkpointedFrames && logFrames >= stats.logFrames)
+			{
+				fresh -= stats.checkpointedFrames;
+			}
+			stats.totalFrames += fresh;
+		}
+		stats.logFrames = logFrames;
+		stats.checkpointedFrames = checkpointed;
+		stats.lastMicros = elapsed;
+		stats.totalMicros += elapsed;
+		if (elapsed > stats.maxMicros)
+		{
+			stats.maxMicros = elapsed;
+		}
+		return true;
+	}
+
+	CheckpointStats Checkpointer::getStats()
+	{
+		Lock lock(*mutex);
+		return stats;
+	}
+}
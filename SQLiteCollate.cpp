@@ -0,0 +1,173 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define SQLITEPP_SSE2
+#endif
+#if defined(_MSC_VER) && !defined(__GNUC__)
+#	include <intrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+	inline unsigned char fold(unsigned char c)
+	{
+		return (unsigned char)(c - 'A') < 26 ? (unsigned char)(c | 0x20) : c;
+	}
+
+	inline bool isDigit(unsigned char c)
+	{
+		return (unsigned char)(c - '0') < 10;
+	}
+
+	inline int compareLengths(unsigned aLength, unsigned bLength)
+	{
+		return aLength < bLength ? -1 : (aLength > bLength ? 1 : 0);
+	}
+
+#ifdef SQLITEPP_SSE2
+	inline unsigned lowestBit(unsigned m)
+	{
+#if defined(__GNUC__)
+		return (unsigned)__builtin_ctz(m);
+#elif defined(_MSC_VER)
+		unsigned long rv;
+		_BitScanForward(&rv, m);
+		return (unsigned)rv;
+#else
+		unsigned rv = 0;
+		while (!(m & 1))
+		{
+			m >>= 1;
+			++rv;
+		}
+		return rv;
+#endif
+	}
+
+	inline __m128i fold(__m128i v)
+	{
+		// bytes >= 0x80 are negative and never upper case
+		__m128i upper = _mm_and_si128(
+			_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1))
+			);
+		return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+	}
+#endif
+}
+
+namespace SQLite
+{
+	int AsciiNoCase::operator()(const char *a, unsigned aLength, const char *b, unsigned bLength) const
+	{
+		const unsigned char *p = (const unsigned char*)a, *q = (const unsigned char*)b;
+		unsigned n = aLength < bLength ? aLength : bLength, i = 0;
+#ifdef SQLITEPP_SSE2
+		for (; i + 16 <= n; i += 16)
+		{
+			__m128i x = fold(_mm_loadu_si128((const __m128i*)(p + i)));
+			__m128i y = fold(_mm_loadu_si128((const __m128i*)(q + i)));
+			unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+			if (m)
+			{
+				i += lowestBit(m);
+				return (int)fold(p[i]) - (int)fold(q[i]);
+			}
+		}
+#endif
+		for (; i < n; ++i)
+		{
+			int diff = (int)fold(p[i]) - (int)fold(q[i]);
+			if (diff)
+			{
+				return diff;
+			}
+		}
+		return compareLengths(aLength, bLength);
+	}
+
+	int NaturalOrder::operator()(const char *a, unsigned aLength, const char *b, unsigned bLength) const
+	{
+		const unsigned char *p = (const unsigned char*)a, *q = (const unsigned char*)b;
+		unsigned i = 0, j = 0;
+		while (i < aLength && j < bLength)
+		{
+			if (isDigit(p[i]) && isDigit(q[j]))
+			{
+				unsigned zi = i, zj = j;
+				while (i < aLength && p[i] == '0')
+				{
+					++i;
+				}
+				while (j < bLength && q[j] == '0')
+				{
+					++j;
+				}
+				unsigned si = i, sj = j;
+				while (i < aLength && isDigit(p[i]))
+				{
+					++i;
+				}
+				while (j < bLength && isDigit(q[j]))
+				{
+					++j;
+				}
+				// without leading zeros, the longer number is the larger one
+				if (i - si != j - sj)
+				{
+					return i - si < j - sj ? -1 : 1;
+				}
+				int rv = memcmp(p + si, q + sj, i - si);
+				if (rv)
+				{
+					return rv;
+				}
+				// same value: fewer leading zeros first
+				if (si - zi != sj - zj)
+				{
+					return si - zi < sj - zj ? -1 : 1;
+				}
+				continue;
+			}
+			int diff = (int)fold(p[i]) - (int)fold(q[j]);
+			if (diff)
+			{
+				return diff;
+			}
+			++i;
+			++j;
+		}
+		return compareLengths(aLength - i, bLength - j);
+	}
+
+	int Utf8Order::operator()(const char *a, unsigned aLength, const char *b, unsigned bLength) const
+	{
+		int rv = memcmp(a, b, aLength < bLength ? aLength : bLength);
+		return rv ? rv : compareLengths(aLength, bLength);
+	}
+
+	void DB::registerCollations()
+	{
+		registerCollation("ASCII_NOCASE", AsciiNoCase());
+		registerCollation("NATURAL_ORDER", NaturalOrder());
+		registerCollation("UTF8", Utf8Order());
+	}
+}
@@ -0,0 +1,347 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+
+#include <map>
+
+using namespace std;
+
+namespace
+{
+	inline bool isIdentChar(char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+			c == '_' || c == '$' || (c & 0x80);
+	}
+
+	inline bool isWord(const string& aWord, const char *aKeyword)
+	{
+		return sqlite3_stricmp(aWord.c_str(), aKeyword) == 0;
+	}
+}
+
+namespace SQLite
+{
+	class FormatCache
+	{
+	public:
+		enum
+		{
+			MAX_ENTRIES = 256
+		};
+
+		struct Entry
+		{
+			bool parameterized;
+			std::string sql;
+			// one per parameter: 'q', 'Q', 'd', 'l' (%lld) or 'f'
+			std::string args;
+			Stmt *stmt;
+			// executing, when execute() is called again from within
+			bool busy;
+		};
+		typedef map<string, Entry> EntryMap;
+		EntryMap entries;
+
+		~FormatCache()
+		{
+			for (EntryMap::iterator i = entries.begin(), e = entries.end(); i != e; ++i)
+			{
+				delete i->second.stmt;
+			}
+		}
+
+		static bool rewrite(const char *aFormat, string& aSql, string& aArgs);
+
+		static Stmt *prepare(DB& aDB, const string& aSql)
+		{
+			return new Stmt(aDB, aSql);
+		}
+		static unsigned getParamCount(const Stmt& aStmt)
+		{
+			return aStmt.params;
+		}
+	};
+
+	// Only conversions standing for a whole literal become parameters;
+	// formats that build identifiers, keywords or parts of literals are
+	// left to sqlite3_vmprintf.
+	bool FormatCache::rewrite(const char *aFormat, string& aSql, string& aArgs)
+	{
+		enum
+		{
+			CODE,
+			QUOTE,
+			IDENT,
+			LINE_COMMENT,
+			BLOCK_COMMENT
+		} state = CODE;
+		char close = 0;
+		const char *quote = NULL;
+		string word, previous;
+		// integers after ORDER BY and GROUP BY name result columns
+		bool ordering = false;
+
+		for (const char *p = aFormat; *p; ++p)
+		{
+			char c = *p;
+			if (c == '%')
+			{
+				if (p[1] == '%')
+				{
+					aSql += '%';
+					++p;
+					continue;
+				}
+				if (state == QUOTE && p[1] == 'q' && quote == p - 1 && p[2] == '\'' && p[3] != '\'')
+				{
+					// '%q' becomes ?
+					aSql.erase(aSql.length() - 1);
+					aSql += '?';
+					aArgs += 'q';
+					p += 2;
+					state = CODE;
+					continue;
+				}
+				if (state != CODE || (p > aFormat && isIdentChar(p[-1])))
+				{
+					return false;
+				}
+				char arg;
+				unsigned length;
+				if (p[1] == 'Q')
+				{
+					arg = 'Q';
+					length = 1;
+				}
+				else if (p[1] == 'd' || p[1] == 'i')
+				{
+					arg = 'd';
+					length = 1;
+				}
+				else if (p[1] == 'l' && p[2] == 'l' && (p[3] == 'd' || p[3] == 'i'))
+				{
+					arg = 'l';
+					length = 3;
+				}
+				else if (p[1] == 'f')
+				{
+					arg = 'f';
+					length = 1;
+				}
+				else
+				{
+					return false;
+				}
+				if ((arg != 'Q' && ordering) || isIdentChar(p[length + 1]))
+				{
+					return false;
+				}
+				aSql += '?';
+				aArgs += arg;
+				p += length;
+				continue;
+			}
+
+			switch (state)
+			{
+				case CODE:
+					if (isIdentChar(c))
+					{
+						word += c;
+					}
+					else if (!word.empty())
+					{
+						if (isWord(word, "BY") && (isWord(previous, "ORDER") || isWord(previous, "GROUP")))
+						{
+							ordering = true;
+						}
+						previous.swap(word);
+						word.clear();
+					}
+					if (c == '\'')
+					{
+						state = QUOTE;
+						quote = p;
+					}
+					else if (c == '"' || c == '`' || c == '[')
+					{
+						state = IDENT;
+						close = c == '[' ? ']' : c;
+					}
+					else if (c == '-' && p[1] == '-')
+					{
+						state = LINE_COMMENT;
+					}
+					else if (c == '/' && p[1] == '*')
+					{
+						state = BLOCK_COMMENT;
+						aSql += c;
+						c = *++p;
+					}
+					break;
+				case QUOTE:
+					if (c == '\'')
+					{
+						if (p[1] == '\'')
+						{
+							aSql += c;
+							++p;
+						}
+						else
+						{
+							state = CODE;
+						}
+					}
+					break;
+				case IDENT:
+					if (c == close)
+					{
+						if (close != ']' && p[1] == close)
+						{
+							aSql += c;
+							++p;
+						}
+						else
+						{
+							state = CODE;
+						}
+					}
+					break;
+				case LINE_COMMENT:
+					if (c == '\n')
+					{
+						state = CODE;
+					}
+					break;
+				case BLOCK_COMMENT:
+					if (c == '*' && p[1] == '/')
+					{
+						aSql += c;
+						c = *++p;
+						state = CODE;
+					}
+					break;
+			}
+			aSql += c;
+		}
+		return true;
+	}
+
+	void DB::executeFormat(const char *aFormat, va_list ap)
+	{
+		if (!formats)
+		{
+			formats = new FormatCache;
+		}
+		FormatCache::EntryMap::iterator i = formats->entries.find(aFormat);
+		if (i == formats->entries.end() && formats->entries.size() < FormatCache::MAX_ENTRIES)
+		{
+			FormatCache::Entry entry;
+			entry.parameterized = FormatCache::rewrite(aFormat, entry.sql, entry.args);
+			entry.stmt = NULL;
+			entry.busy = false;
+			i = formats->entries.insert(make_pair(string(aFormat), entry)).first;
+		}
+
+		FormatCache::Entry *entry = i != formats->entries.end() ? &i->second : NULL;
+		// the rewritten statement did not prepare, e.g. parameters in DDL
+		bool failed = false;
+		if (entry && entry->parameterized && !entry->busy)
+		{
+			if (!entry->stmt)
+			{
+				try
+				{
+					entry->stmt = FormatCache::prepare(*this, entry->sql);
+				}
+#ifdef __BORLANDC__
+				catch (Exception &ex)
+#else
+				catch (Exception)
+#endif
+				{
+					failed = true;
+				}
+				if (entry->stmt && FormatCache::getParamCount(*entry->stmt) != entry->args.length())
+				{
+					// the format has parameters of its own
+					delete entry->stmt;
+					entry->stmt = NULL;
+					entry->parameterized = false;
+				}
+			}
+			if (entry->stmt)
+			{
+				Stmt& stmt = *entry->stmt;
+				for (unsigned a = 0; a < entry->args.length(); ++a)
+				{
+					switch (entry->args[a])
+					{
+						case 'q':
+						{
+							const char *value = va_arg(ap, const char*);
+							stmt.bind(a + 1, value ? value : "(NULL)");
+							break;
+						}
+						case 'Q':
+							stmt.bind(a + 1, va_arg(ap, const char*));
+							break;
+						case 'd':
+							stmt.bind(a + 1, va_arg(ap, int));
+							break;
+						case 'l':
+							stmt.bind(a + 1, (__int64)va_arg(ap, sqlite3_int64));
+							break;
+						default:
+							stmt.bind(a + 1, va_arg(ap, double));
+							break;
+					}
+				}
+				entry->busy = true;
+				try
+				{
+					stmt.execute();
+				}
+				catch (...)
+				{
+					// ready for the next call, without the arguments of this one
+					stmt.tryReset();
+					sqlite3_clear_bindings(stmt.stmt);
+					entry->busy = false;
+					throw;
+				}
+				entry->busy = false;
+				return;
+			}
+		}
+
+		char *o = sqlite3_vmprintf(aFormat, ap);
+		string query(o);
+		sqlite3_free(o);
+		execute(query);
+		if (failed)
+		{
+			// given up only now that the formatted query worked, so a
+			// missing table does not disable the rewrite for good
+			entry->parameterized = false;
+		}
+	}
+
+	void DB::dropFormats()
+	{
+		delete formats;
+		formats = NULL;
+	}
+}
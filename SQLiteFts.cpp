@@ -0,0 +1,271 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define SQLITEPP_SSE2
+#endif
+#if defined(_MSC_VER) && !defined(__GNUC__)
+#	include <intrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+	fts5_api *fts5(sqlite3 *ctx)
+	{
+		fts5_api *api = NULL;
+		sqlite3_stmt *stmt = NULL;
+		if (sqlite3_prepare_v2(ctx, "SELECT fts5(?1)", -1, &stmt, NULL) != SQLITE_OK)
+		{
+			return NULL;
+		}
+		sqlite3_bind_pointer(stmt, 1, (void*)&api, "fts5_api_ptr", NULL);
+		sqlite3_step(stmt);
+		sqlite3_finalize(stmt);
+		return api;
+	}
+
+	inline bool isWordChar(unsigned char c)
+	{
+		return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c >= 0x80;
+	}
+
+#ifdef SQLITEPP_SSE2
+	inline unsigned lowestBit(unsigned m)
+	{
+#if defined(__GNUC__)
+		return (unsigned)__builtin_ctz(m);
+#elif defined(_MSC_VER)
+		unsigned long rv;
+		_BitScanForward(&rv, m);
+		return (unsigned)rv;
+#else
+		unsigned rv = 0;
+		while (!(m & 1))
+		{
+			m >>= 1;
+			++rv;
+		}
+		return rv;
+#endif
+	}
+
+	// bit i is set if p[i] is a word character
+	inline unsigned wordMask(const unsigned char *p)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		__m128i alpha = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+		alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(25)), alpha);
+		__m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+		digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+		// the sign bit marks UTF-8 sequences
+		return (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), v));
+	}
+#endif
+
+	// Advances from pos while characters are (aWord) or are not word
+	// characters
+	unsigned skip(const unsigned char *p, unsigned pos, unsigned length, bool aWord)
+	{
+#ifdef SQLITEPP_SSE2
+		while (pos + 16 <= length)
+		{
+			unsigned m = wordMask(p + pos);
+			if (aWord)
+			{
+				m = ~m & 0xffff;
+			}
+			if (m)
+			{
+				return pos + lowestBit(m);
+			}
+			pos += 16;
+		}
+#endif
+		while (pos < length && isWordChar(p[pos]) == aWord)
+		{
+			++pos;
+		}
+		return pos;
+	}
+}
+
+namespace SQLite
+{
+	Tokenizer::Tokenizer(const string& aName)
+		: name(aName)
+	{}
+
+	int Tokenizer::xCreate(void *aTokenizer, const char **, int, Fts5Tokenizer **aOut)
+	{
+		*aOut = reinterpret_cast<Fts5Tokenizer*>(aTokenizer);
+		return SQLITE_OK;
+	}
+	void Tokenizer::xDelete(Fts5Tokenizer *)
+	{
+		// owned by the DB
+	}
+	int Tokenizer::xTokenize(Fts5Tokenizer *aTokenizer, void *aCtx, int aFlags, const char *aText, int aLength, int (*aToken)(void *, int, const char *, int, int, int))
+	{
+		TokenSink sink(aCtx, aToken);
+		try
+		{
+			reinterpret_cast<Tokenizer*>(aTokenizer)->tokenize(aText, (unsigned)aLength, aFlags, sink);
+		}
+		catch (...)
+		{
+			return SQLITE_ERROR;
+		}
+		return sink.rc;
+	}
+
+	void WordTokenizer::tokenize(const char *aText, unsigned aLength, int, TokenSink& aSink)
+	{
+		const unsigned char *p = (const unsigned char*)aText;
+		string token;
+		unsigned pos = 0;
+		while ((pos = skip(p, pos, aLength, false)) < aLength)
+		{
+			unsigned end = skip(p, pos, aLength, true);
+			token.assign(aText + pos, end - pos);
+			for (string::iterator i = token.begin(), e = token.end(); i != e; ++i)
+			{
+				if (*i >= 'A' && *i <= 'Z')
+				{
+					*i += 'a' - 'A';
+				}
+			}
+			if (!aSink.token(token.data(), (unsigned)token.length(), pos, end))
+			{
+				return;
+			}
+			pos = end;
+		}
+	}
+
+	void DB::registerTokenizer(Tokenizer *aTokenizer)
+	{
+		fts5_api *api = fts5(ctx);
+		if (!api)
+		{
+			delete aTokenizer;
+			throw Exception("FTS5 is not available");
+		}
+		fts5_tokenizer callbacks;
+		callbacks.xCreate = Tokenizer::xCreate;
+		callbacks.xDelete = Tokenizer::xDelete;
+		callbacks.xTokenize = Tokenizer::xTokenize;
+		if (SQLITE_OK != api->xCreateTokenizer(
+			api,
+			aTokenizer->name.c_str(),
+			aTokenizer,
+			&callbacks,
+			NULL
+		))
+		{
+			delete aTokenizer;
+			throw Exception(ctx);
+		}
+		tokenizers.push_back(aTokenizer);
+	}
+
+	FtsBulkIndex::FtsBulkIndex(DB& aDB, const string& aTable, int aCrisisMerge)
+		: db(aDB), table(aTable), automerge(4), crisismerge(16),
+		hadAutomerge(false), hadCrisismerge(false), finished(false)
+	{
+		Stmt stmt = db.prepare(mprintf("SELECT k, v FROM \"%w_config\" WHERE k IN ('automerge', 'crisismerge')", table.c_str()));
+		while (stmt.next())
+		{
+			if (stmt[0] == "automerge")
+			{
+				automerge = stmt[1];
+				hadAutomerge = true;
+			}
+			else
+			{
+				crisismerge = stmt[1];
+				hadCrisismerge = true;
+			}
+		}
+		stmt.finalize();
+
+		configure("automerge", 0);
+		try
+		{
+			configure("crisismerge", aCrisisMerge);
+		}
+		catch (...)
+		{
+			// the destructor does not run
+			try {
+				restore();
+#ifdef __BORLANDC__
+			} catch (SQLite::Exception &ex) {
+#else
+			} catch (SQLite::Exception) {
+#endif
+			}
+			throw;
+		}
+	}
+	FtsBulkIndex::~FtsBulkIndex()
+	{
+		if (!finished)
+		{
+			try {
+				restore();
+#ifdef __BORLANDC__
+			} catch (SQLite::Exception &ex) {
+#else
+			} catch (SQLite::Exception) {
+#endif
+			}
+		}
+	}
+
+	void FtsBulkIndex::configure(const char *aKey, int aValue)
+	{
+		db.execute(mprintf("INSERT INTO \"%w\"(\"%w\", rank) VALUES(%Q, %d)", table.c_str(), table.c_str(), aKey, aValue));
+	}
+	void FtsBulkIndex::restore(const char *aKey, int aValue, bool aHad)
+	{
+		// configure() also updates the settings FTS5 has loaded already
+		configure(aKey, aValue);
+		if (!aHad)
+		{
+			// absent again, so the table follows the library's defaults;
+			// writing the shadow table fails with SQLITE_DBCONFIG_DEFENSIVE,
+			// which leaves the default in place explicitly
+			db.tryExecute(mprintf("DELETE FROM \"%w_config\" WHERE k = %Q", table.c_str(), aKey));
+		}
+	}
+	void FtsBulkIndex::restore()
+	{
+		restore("automerge", automerge, hadAutomerge);
+		restore("crisismerge", crisismerge, hadCrisismerge);
+	}
+	void FtsBulkIndex::finish()
+	{
+		if (finished)
+		{
+			throw Exception("Bulk index already finished");
+		}
+		db.execute(mprintf("INSERT INTO \"%w\"(\"%w\") VALUES('optimize')", table.c_str(), table.c_str()));
+		finished = true;
+		restore();
+	}
+}
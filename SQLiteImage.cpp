@@ -0,0 +1,308 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteThread.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef SQLITEPP_WIN32_THREADS
+#	include <windows.h>
+#else
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace SQLite
+{
+	class ImageData
+	{
+	public:
+		enum Storage
+		{
+			BORROWED,
+			// sqlite3_malloc()ed
+			OWNED,
+			MAPPED
+		};
+
+		volatile long refs;
+		const void *data;
+		size_t size;
+		Storage storage;
+
+		ImageData(const void *aData, size_t aSize, Storage aStorage)
+			: refs(1), data(aData), size(aSize), storage(aStorage)
+		{}
+		~ImageData()
+		{
+			switch (storage)
+			{
+				case OWNED:
+					sqlite3_free(const_cast<void*>(data));
+					break;
+				case MAPPED:
+					if (data)
+					{
+#ifdef SQLITEPP_WIN32_THREADS
+						UnmapViewOfFile(data);
+#else
+						munmap(const_cast<void*>(data), size);
+#endif
+					}
+					break;
+				default:
+					break;
+			}
+		}
+	};
+
+	Image::Image()
+		: data(NULL)
+	{}
+	Image::Image(ImageData *aData)
+		: data(aData)
+	{}
+	Image::Image(const Image &c)
+		: data(c.data)
+	{
+		if (data)
+		{
+			atomicAdd(&data->refs, 1);
+		}
+	}
+	Image::~Image()
+	{
+		if (data && atomicAdd(&data->refs, -1) == 0)
+		{
+			delete data;
+		}
+	}
+	Image& Image::operator=(const Image &c)
+	{
+		if (c.data)
+		{
+			atomicAdd(&c.data->refs, 1);
+		}
+		if (data && atomicAdd(&data->refs, -1) == 0)
+		{
+			delete data;
+		}
+		data = c.data;
+		return *this;
+	}
+
+	Image Image::fromFile(const string& aFile)
+	{
+#ifdef SQLITEPP_WIN32_THREADS
+		HANDLE file = CreateFileA(aFile.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			throw Exception("Cannot open image: " + aFile);
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size))
+		{
+			CloseHandle(file);
+			throw Exception("Cannot open image: " + aFile);
+		}
+		if (!size.QuadPart)
+		{
+			CloseHandle(file);
+			return Image(new ImageData(NULL, 0, ImageData::MAPPED));
+		}
+		HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file);
+		if (!mapping)
+		{
+			throw Exception("Cannot map image: " + aFile);
+		}
+		const void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		// the view keeps the mapping alive
+		CloseHandle(mapping);
+		if (!view)
+		{
+			throw Exception("Cannot map image: " + aFile);
+		}
+		return Image(new ImageData(view, (size_t)size.QuadPart, ImageData::MAPPED));
+#else
+		int fd = ::open(aFile.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			throw Exception("Cannot open image: " + aFile);
+		}
+		struct stat st;
+		if (fstat(fd, &st))
+		{
+			::close(fd);
+			throw Exception("Cannot open image: " + aFile);
+		}
+		if (!st.st_size)
+		{
+			::close(fd);
+			return Image(new ImageData(NULL, 0, ImageData::MAPPED));
+		}
+		void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (view == MAP_FAILED)
+		{
+			throw Exception("Cannot map image: " + aFile);
+		}
+		return Image(new ImageData(view, (size_t)st.st_size, ImageData::MAPPED));
+#endif
+	}
+	Image Image::fromBuffer(const void *aData, size_t aLength)
+	{
+		return Image(new ImageData(aData, aLength, ImageData::BORROWED));
+	}
+
+	const void *Image::getData() const
+	{
+		return data ? data->data : NULL;
+	}
+	size_t Image::getSize() const
+	{
+		return data ? data->size : 0;
+	}
+
+	void Image::save(const string& aFile) const
+	{
+		FILE *f = fopen(aFile.c_str(), "wb");
+		if (!f)
+		{
+			throw Exception("Cannot create image: " + aFile);
+		}
+		size_t size = getSize();
+		bool ok = !size || fwrite(getData(), 1, size, f) == size;
+		if (fclose(f) || !ok)
+		{
+			throw Exception("Cannot write image: " + aFile);
+		}
+	}
+
+	Image DB::serialize(const string& aSchema)
+	{
+		sqlite3_int64 size = 0;
+		unsigned char *data = sqlite3_serialize(ctx, aSchema.c_str(), &size, 0);
+		if (!data)
+		{
+			// a database without any pages yet serializes to nothing
+			if (sqlite3_serialize(ctx, aSchema.c_str(), &size, SQLITE_SERIALIZE_NOCOPY) || size)
+			{
+				throw Exception("Cannot serialize " + aSchema);
+			}
+		}
+		return Image(new ImageData(data, (size_t)size, ImageData::OWNED));
+	}
+
+	void DB::deserialize(const Image& aImage, bool aReadOnly, const string& aSchema)
+	{
+		sqlite3_int64 size = (sqlite3_int64)aImage.getSize();
+		unsigned char *data;
+		unsigned flags;
+		if (aReadOnly)
+		{
+			data = (unsigned char*)aImage.getData();
+			flags = SQLITE_DESERIALIZE_READONLY;
+		}
+		else
+		{
+			data = (unsigned char*)sqlite3_malloc64(size ? size : 1);
+			if (!data)
+			{
+				throw Exception(SQLITE_NOMEM);
+			}
+			if (size)
+			{
+				memcpy(data, aImage.getData(), (size_t)size);
+			}
+			flags = SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE;
+		}
+
+		// with FREEONCLOSE the buffer is freed even if this fails
+		if (SQLITE_OK != sqlite3_deserialize(ctx, aSchema.c_str(), data, size, size, flags))
+		{
+			throw Exception(ctx);
+		}
+
+		for (ImageList::iterator i = images.begin(), e = images.end(); i != e; ++i)
+		{
+			if (i->first == aSchema)
+			{
+				images.erase(i);
+				break;
+			}
+		}
+		if (aReadOnly)
+		{
+			images.push_back(make_pair(aSchema, aImage));
+		}
+	}
+
+	void MemoryDB::copyFrom(DB& aSource, const string& aSchema)
+	{
+		sqlite3_int64 size = 0;
+		// an in-memory source hands out its pages directly
+		const unsigned char *pages = sqlite3_serialize(aSource.ctx, aSchema.c_str(), &size, SQLITE_SERIALIZE_NOCOPY);
+		unsigned char *data;
+		if (pages)
+		{
+			data = (unsigned char*)sqlite3_malloc64(size ? size : 1);
+			if (!data)
+			{
+				throw Exception(SQLITE_NOMEM);
+			}
+			memcpy(data, pages, (size_t)size);
+		}
+		else
+		{
+			data = sqlite3_serialize(aSource.ctx, aSchema.c_str(), &size, 0);
+			if (!data)
+			{
+				if (size)
+				{
+					throw Exception("Cannot serialize " + aSchema);
+				}
+				data = (unsigned char*)sqlite3_malloc64(1);
+				if (!data)
+				{
+					throw Exception(SQLITE_NOMEM);
+				}
+			}
+		}
+		if (SQLITE_OK != sqlite3_deserialize(
+			ctx,
+			"main",
+			data,
+			size,
+			size,
+			SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE
+			))
+		{
+			throw Exception(ctx);
+		}
+		for (ImageList::iterator i = images.begin(), e = images.end(); i != e; ++i)
+		{
+			if (i->first == "main")
+			{
+				images.erase(i);
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,115 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteCheck.h"
+
+#include <map>
+#include <set>
+
+using namespace std;
+
+namespace SQLite
+{
+	bool PlanNode::isFullScan() const
+	{
+		// "SCAN t" or "SCAN TABLE t" with older libraries; index scans,
+		// virtual tables, constant rows and the results of subqueries and
+		// CTEs (materialized already) are fine
+		return detail.compare(0, 5, "SCAN ") == 0
+			&& !subquery
+			&& detail.compare(0, 15, "SCAN (subquery-") != 0
+			&& detail.compare(0, 14, "SCAN SUBQUERY ") != 0
+			&& detail.compare(0, 9, "SCAN CTE ") != 0
+			&& detail.find(" INDEX") == string::npos
+			&& detail.find("VIRTUAL TABLE") == string::npos
+			&& detail.find("CONSTANT ROW") == string::npos;
+	}
+	bool PlanNode::usesTempBTree() const
+	{
+		return detail.find("USE TEMP B-TREE") != string::npos;
+	}
+
+	Plan Stmt::explainPlan()
+	{
+		CHKTHROW
+		Plan rv;
+		bool wasExplaining = owner.explaining;
+		owner.explaining = true;
+		try
+		{
+			Stmt explain = owner.prepare("EXPLAIN QUERY PLAN " + sql);
+			map<int, unsigned> depths;
+			// names of subquery and CTE results, scanned by name later on
+			set<string> results;
+			while (explain.next())
+			{
+				int id = explain[0];
+				int parent = explain[1];
+				map<int, unsigned>::const_iterator p = depths.find(parent);
+				unsigned depth = p == depths.end() ? 0 : p->second + 1;
+				depths[id] = depth;
+				PlanNode node(id, parent, depth, explain[3].asString());
+				if (node.detail.compare(0, 12, "MATERIALIZE ") == 0)
+				{
+					results.insert(node.detail.substr(12));
+				}
+				else if (node.detail.compare(0, 11, "CO-ROUTINE ") == 0)
+				{
+					results.insert(node.detail.substr(11));
+				}
+				else if (node.detail.compare(0, 5, "SCAN ") == 0)
+				{
+					node.subquery = results.count(node.detail.substr(5)) != 0;
+				}
+				rv.push_back(node);
+			}
+		}
+		catch (...)
+		{
+			owner.explaining = wasExplaining;
+			throw;
+		}
+		owner.explaining = wasExplaining;
+		return rv;
+	}
+
+	StmtStatus Stmt::getStatus(bool aReset)
+	{
+		CHKTHROW
+		int r = aReset ? 1 : 0;
+		StmtStatus rv;
+		rv.fullscanSteps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, r);
+		rv.sorts = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, r);
+		rv.autoindexes = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, r);
+		rv.vmSteps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, r);
+		return rv;
+	}
+
+	void DB::checkPlan(Stmt& aStmt)
+	{
+		if (explaining)
+		{
+			return;
+		}
+		Plan plan = aStmt.explainPlan();
+		for (Plan::const_iterator i = plan.begin(), e = plan.end(); i != e; ++i)
+		{
+			if (i->isFullScan() || i->usesTempBTree())
+			{
+				planChecker->badPlan(aStmt, plan);
+				break;
+			}
+		}
+	}
+}
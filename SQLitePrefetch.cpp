@@ -0,0 +1,202 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteCache.h"
+#include "SQLiteThread.h"
+
+using namespace std;
+
+namespace SQLite
+{
+	class PrefetchThread : public Thread
+	{
+	private:
+		PrefetchCursor& owner;
+
+	public:
+		explicit PrefetchThread(PrefetchCursor& aOwner)
+			: owner(aOwner)
+		{}
+
+	protected:
+		virtual void run() { owner.run(); }
+	};
+
+	PrefetchCursor::PrefetchCursor(Stmt& aStmt, unsigned aDepth)
+		: stmt(aStmt), columns(aStmt.getColumnCount()), slots(NULL), mask(0),
+		head(0), tail(0), row(NULL), finished(0), stopping(0),
+		consumerWaiting(0), producerWaiting(0), produced(NULL), consumed(NULL),
+		thread(NULL), failed(false), errorCode(-1), timedOut(false)
+	{
+		unsigned long capacity = 2;
+		while (capacity < aDepth)
+		{
+			capacity <<= 1;
+		}
+		mask = capacity - 1;
+		slots = new ResultData*[capacity];
+		for (unsigned long i = 0; i < capacity; ++i)
+		{
+			slots[i] = new ResultData(columns);
+		}
+		produced = new Signal();
+		consumed = new Signal();
+
+		thread = new PrefetchThread(*this);
+		try
+		{
+			thread->start();
+		}
+		catch (...)
+		{
+			// the destructor does not run
+			delete thread;
+			delete consumed;
+			delete produced;
+			for (unsigned long i = 0; i < capacity; ++i)
+			{
+				delete slots[i];
+			}
+			delete [] slots;
+			throw;
+		}
+	}
+	PrefetchCursor::~PrefetchCursor()
+	{
+		atomicSet(&stopping, 1);
+		consumed->set();
+		thread->join();
+		delete thread;
+		stmt.tryReset();
+
+		delete consumed;
+		delete produced;
+		for (unsigned long i = 0; i <= mask; ++i)
+		{
+			delete slots[i];
+		}
+		delete [] slots;
+	}
+
+	void PrefetchCursor::run()
+	{
+		try
+		{
+			long h = atomicGet(&head);
+			while (!atomicGet(&stopping))
+			{
+				// wait for a free slot
+				if ((unsigned long)(h - atomicGet(&tail)) > mask)
+				{
+					atomicSet(&producerWaiting, 1);
+					if ((unsigned long)(h - atomicGet(&tail)) > mask)
+					{
+						consumed->wait(10);
+					}
+					atomicSet(&producerWaiting, 0);
+					continue;
+				}
+
+				Status rv = stmt.tryNext();
+				if (!rv)
+				{
+					failed = true;
+					errorCode = rv.getCode();
+					error = sqlite3_errmsg(stmt.owner.ctx);
+					timedOut = stmt.owner.timedOut;
+					stmt.owner.timedOut = false;
+					break;
+				}
+				if (!rv.hasRow())
+				{
+					break;
+				}
+
+				ResultData *slot = slots[(unsigned long)h & mask];
+				slot->cells.clear();
+				slot->arena.clear();
+				slot->append(stmt.stmt);
+
+				h = (long)((unsigned long)h + 1);
+				atomicSet(&head, h);
+				if (atomicGet(&consumerWaiting))
+				{
+					produced->set();
+				}
+			}
+		}
+		catch (...)
+		{
+			failed = true;
+			error = "Unknown error while prefetching";
+		}
+		atomicSet(&finished, 1);
+		produced->set();
+	}
+
+	bool PrefetchCursor::next()
+	{
+		long t = atomicGet(&tail);
+		if (row)
+		{
+			t = (long)((unsigned long)t + 1);
+			atomicSet(&tail, t);
+			row = NULL;
+			if (atomicGet(&producerWaiting))
+			{
+				consumed->set();
+			}
+		}
+
+		while (atomicGet(&head) == t)
+		{
+			if (atomicGet(&finished))
+			{
+				// the producer may have published its last row meanwhile
+				if (atomicGet(&head) != t)
+				{
+					break;
+				}
+				if (failed)
+				{
+					if (errorCode == SQLITE_INTERRUPT)
+					{
+						throw Interrupted(error, timedOut);
+					}
+					throw Exception(errorCode, error);
+				}
+				return false;
+			}
+			atomicSet(&consumerWaiting, 1);
+			if (atomicGet(&head) == t && !atomicGet(&finished))
+			{
+				produced->wait(10);
+			}
+			atomicSet(&consumerWaiting, 0);
+		}
+		row = slots[(unsigned long)t & mask];
+		return true;
+	}
+
+	Field PrefetchCursor::value(unsigned col) const
+	{
+#ifndef NDEBUG
+		if (!row || col >= columns)
+		{
+			throw Exception("Invalid Field");
+		}
+#endif
+		return Field(row, col);
+	}
+}
@@ -0,0 +1,165 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteThread.h"
+
+#include <stdio.h>
+
+using namespace std;
+
+namespace
+{
+	string immutableUri(const string& aPath)
+	{
+		string rv = "file:";
+#ifdef SQLITEPP_WIN32_THREADS
+		if (aPath.length() > 1 && aPath[1] == ':')
+		{
+			rv += '/';
+		}
+#endif
+		for (unsigned i = 0; i < aPath.length(); ++i)
+		{
+			char c = aPath[i];
+			if (c == '%' || c == '?' || c == '#')
+			{
+				char buf[4];
+				sprintf(buf, "%%%02X", (unsigned char)c);
+				rv += buf;
+			}
+#ifdef SQLITEPP_WIN32_THREADS
+			else if (c == '\\')
+			{
+				rv += '/';
+			}
+#endif
+			else
+			{
+				rv += c;
+			}
+		}
+		return rv + "?immutable=1&nolock=1";
+	}
+}
+
+namespace SQLite
+{
+	ImmutableDB::ImmutableDB(const string& aPath, __int64 aMmapSize)
+		: DB(immutableUri(aPath), SQLITE_OPEN_READONLY | SQLITE_OPEN_URI | SQLITE_OPEN_NOMUTEX)
+	{
+		execute(mprintf("PRAGMA mmap_size = %lld", (sqlite3_int64)aMmapSize));
+	}
+
+	ReadOnlyPool::ReadOnlyPool(const string& aPath, __int64 aMmapSize)
+		: path(aPath), mmapSize(aMmapSize), mutex(new Mutex)
+	{}
+	ReadOnlyPool::~ReadOnlyPool()
+	{
+		for (unsigned i = 0; i < all.size(); ++i)
+		{
+			delete all[i];
+		}
+		delete mutex;
+	}
+
+	ImmutableDB *ReadOnlyPool::acquire()
+	{
+		{
+			Lock lock(*mutex);
+			if (!idle.empty())
+			{
+				ImmutableDB *rv = idle.back();
+				idle.pop_back();
+				return rv;
+			}
+		}
+		// opened outside the lock, other threads keep leasing meanwhile
+		ImmutableDB *rv = new ImmutableDB(path, mmapSize);
+		try
+		{
+			Lock lock(*mutex);
+			all.push_back(rv);
+			idle.reserve(all.size());
+		}
+		catch (...)
+		{
+			delete rv;
+			throw;
+		}
+		return rv;
+	}
+	void ReadOnlyPool::release(ImmutableDB *aDB)
+	{
+		Lock lock(*mutex);
+		// cannot throw, all connections fit
+		idle.push_back(aDB);
+	}
+
+	void ReadOnlyPool::reserve(unsigned aCount)
+	{
+		vector<ImmutableDB*> opened;
+		try
+		{
+			for (;;)
+			{
+				{
+					Lock lock(*mutex);
+					if (all.size() >= aCount)
+					{
+						break;
+					}
+				}
+				opened.push_back(acquire());
+			}
+		}
+		catch (...)
+		{
+			for (unsigned i = 0; i < opened.size(); ++i)
+			{
+				release(opened[i]);
+			}
+			throw;
+		}
+		for (unsigned i = 0; i < opened.size(); ++i)
+		{
+			release(opened[i]);
+		}
+	}
+
+	ReaderList ReadOnlyPool::getConnections(unsigned aCount)
+	{
+		ReaderList rv;
+		try
+		{
+			rv.reserve(aCount);
+			while (rv.size() < aCount)
+			{
+				rv.push_back(acquire());
+			}
+		}
+		catch (...)
+		{
+			releaseConnections(rv);
+			throw;
+		}
+		return rv;
+	}
+	void ReadOnlyPool::releaseConnections(const ReaderList& aConnections)
+	{
+		for (unsigned i = 0; i < aConnections.size(); ++i)
+		{
+			release(static_cast<ImmutableDB*>(aConnections[i]));
+		}
+	}
+}
@@ -0,0 +1,308 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteThread.h"
+
+using namespace std;
+
+namespace
+{
+	class RegistryThread : public SQLite::Thread
+	{
+	private:
+		SQLite::StatementRegistry& registry;
+		SQLite::DB& db;
+		bool warming;
+
+	public:
+		bool failed;
+		string error;
+
+		RegistryThread(SQLite::StatementRegistry& aRegistry, SQLite::DB& aDB, bool aWarming)
+			: registry(aRegistry), db(aDB), warming(aWarming), failed(false)
+		{}
+
+	protected:
+		virtual void run()
+		{
+			try
+			{
+				if (warming)
+				{
+					registry.warmup(db);
+				}
+				else
+				{
+					registry.attach(db);
+				}
+			}
+			catch (SQLite::Exception &ex)
+			{
+				failed = true;
+#ifdef __BORLANDC__
+				error = ex.Message.c_str();
+#else
+				error = ex.getErrorMsg();
+#endif
+			}
+			catch (...)
+			{
+				failed = true;
+				error = "Unknown error while preparing statements";
+			}
+		}
+	};
+
+	void runAll(vector<RegistryThread*>& threads)
+	{
+		try
+		{
+			for (unsigned i = 0; i < threads.size(); ++i)
+			{
+				threads[i]->start();
+			}
+		}
+		catch (...)
+		{
+			for (unsigned i = 0; i < threads.size(); ++i)
+			{
+				threads[i]->join();
+				delete threads[i];
+			}
+			threads.clear();
+			throw;
+		}
+
+		string error;
+		for (unsigned i = 0; i < threads.size(); ++i)
+		{
+			threads[i]->join();
+			if (threads[i]->failed && error.empty())
+			{
+				error = threads[i]->error;
+			}
+			delete threads[i];
+		}
+		threads.clear();
+		if (!error.empty())
+		{
+			throw SQLite::Exception(error);
+		}
+	}
+}
+
+namespace SQLite
+{
+	StatementRegistry::StatementRegistry()
+		: mutex(new Mutex)
+	{}
+	StatementRegistry::~StatementRegistry()
+	{
+		while (!connections.empty())
+		{
+			detach(*connections.back()->db);
+		}
+		delete mutex;
+	}
+
+	unsigned StatementRegistry::add(const string& aName, const string& aQuery)
+	{
+		if (!connections.empty())
+		{
+			throw Exception("Statements must be added before attaching");
+		}
+		if (names.find(aName) != names.end())
+		{
+			throw Exception("Duplicate statement: " + aName);
+		}
+		unsigned id = (unsigned)queries.size();
+		queries.push_back(aQuery);
+		names[aName] = id;
+		return id;
+	}
+	void StatementRegistry::addHot(const string& aTableOrIndex)
+	{
+		hot.push_back(aTableOrIndex);
+	}
+
+	StatementRegistry::Connection *StatementRegistry::find(DB& aDB) const
+	{
+		for (ConnectionList::const_iterator i = connections.begin(), e = connections.end(); i != e; ++i)
+		{
+			if ((*i)->db == &aDB)
+			{
+				return *i;
+			}
+		}
+		return NULL;
+	}
+
+	void StatementRegistry::attach(DB& aDB)
+	{
+		Connection *conn = new Connection;
+		conn->db = &aDB;
+		try
+		{
+			conn->stmts.reserve(queries.size());
+			for (unsigned i = 0; i < queries.size(); ++i)
+			{
+				try
+				{
+					conn->stmts.push_back(new Stmt(aDB, queries[i]));
+				}
+				catch (Exception &ex)
+				{
+					string name;
+					for (NameMap::const_iterator n = names.begin(), e = names.end(); n != e; ++n)
+					{
+						if (n->second == i)
+						{
+							name = n->first;
+							break;
+						}
+					}
+#ifdef __BORLANDC__
+					throw Exception("Cannot prepare " + name + ": " + ex.Message.c_str());
+#else
+					throw Exception("Cannot prepare " + name + ": " + ex.getErrorMsg());
+#endif
+				}
+			}
+		}
+		catch (...)
+		{
+			for (unsigned i = 0; i < conn->stmts.size(); ++i)
+			{
+				delete conn->stmts[i];
+			}
+			delete conn;
+			throw;
+		}
+
+		// attach(ReaderList&) comes here from several threads
+		Lock lock(*mutex);
+		connections.push_back(conn);
+	}
+	void StatementRegistry::attach(ReaderList& aPool)
+	{
+		vector<RegistryThread*> threads;
+		for (unsigned i = 0; i < aPool.size(); ++i)
+		{
+			threads.push_back(new RegistryThread(*this, *aPool[i], false));
+		}
+		try
+		{
+			runAll(threads);
+		}
+		catch (...)
+		{
+			for (unsigned i = 0; i < aPool.size(); ++i)
+			{
+				if (find(*aPool[i]))
+				{
+					detach(*aPool[i]);
+				}
+			}
+			throw;
+		}
+	}
+	void StatementRegistry::detach(DB& aDB)
+	{
+		for (ConnectionList::iterator i = connections.begin(), e = connections.end(); i != e; ++i)
+		{
+			if ((*i)->db == &aDB)
+			{
+				for (unsigned s = 0; s < (*i)->stmts.size(); ++s)
+				{
+					delete (*i)->stmts[s];
+				}
+				delete *i;
+				connections.erase(i);
+				return;
+			}
+		}
+	}
+
+	Stmt& StatementRegistry::get(DB& aDB, unsigned aId)
+	{
+		Connection *conn = find(aDB);
+		if (!conn || aId >= conn->stmts.size())
+		{
+			throw Exception("Statement not prepared on this connection");
+		}
+		Stmt& stmt = *conn->stmts[aId];
+		stmt.reset();
+		return stmt;
+	}
+	Stmt& StatementRegistry::get(DB& aDB, const string& aName)
+	{
+		NameMap::const_iterator i = names.find(aName);
+		if (i == names.end())
+		{
+			throw Exception("Unknown statement: " + aName);
+		}
+		return get(aDB, i->second);
+	}
+
+	void StatementRegistry::warmup()
+	{
+		vector<RegistryThread*> threads;
+		for (unsigned i = 0; i < connections.size(); ++i)
+		{
+			threads.push_back(new RegistryThread(*this, *connections[i]->db, true));
+		}
+		runAll(threads);
+	}
+	void StatementRegistry::warmup(DB& aDB)
+	{
+		for (unsigned i = 0; i < hot.size(); ++i)
+		{
+			string query;
+			{
+				Stmt stmt = aDB.prepare("SELECT type, tbl_name FROM sqlite_master WHERE name = ?");
+				stmt.bind(1, hot[i]);
+				if (!stmt.next())
+				{
+					throw Exception("No such table or index: " + hot[i]);
+				}
+				if (stmt[0] == "index")
+				{
+					string table = stmt[1];
+					Stmt info = aDB.prepare(mprintf("PRAGMA index_info(\"%w\")", hot[i].c_str()));
+					if (!info.next() || info[2].getType() == SQLITE_NULL)
+					{
+						throw Exception("Cannot warm up expression index: " + hot[i]);
+					}
+					string column = info[2];
+					// ordered by its first column, the index is scanned in full
+					query = mprintf(
+						"SELECT \"%w\" FROM \"%w\" INDEXED BY \"%w\" ORDER BY \"%w\"",
+						column.c_str(),
+						table.c_str(),
+						hot[i].c_str(),
+						column.c_str()
+						);
+				}
+				else
+				{
+					query = mprintf("SELECT * FROM \"%w\" NOT INDEXED", hot[i].c_str());
+				}
+			}
+			Stmt stmt = aDB.prepare(query);
+			while (stmt.next())
+			{
+			}
+		}
+	}
+}
@@ -0,0 +1,270 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+
+#ifdef SQLITE_ENABLE_SESSION
+
+using namespace std;
+
+namespace
+{
+	class PolicyHandler : public SQLite::ConflictHandler
+	{
+	private:
+		SQLite::Changeset::ConflictPolicy policy;
+
+	public:
+		explicit PolicyHandler(SQLite::Changeset::ConflictPolicy aPolicy)
+			: policy(aPolicy)
+		{}
+
+		virtual int conflict(int aConflict, const char *, int)
+		{
+			switch (policy)
+			{
+			case SQLite::Changeset::OMIT:
+				return SQLITE_CHANGESET_OMIT;
+			case SQLite::Changeset::REPLACE:
+				if (aConflict == SQLITE_CHANGESET_DATA || aConflict == SQLITE_CHANGESET_CONFLICT)
+				{
+					return SQLITE_CHANGESET_REPLACE;
+				}
+				if (aConflict == SQLITE_CHANGESET_NOTFOUND)
+				{
+					return SQLITE_CHANGESET_OMIT;
+				}
+				return SQLITE_CHANGESET_ABORT;
+			default:
+				return SQLITE_CHANGESET_ABORT;
+			}
+		}
+	};
+
+	// callbacks must not throw through SQLite
+	struct CallbackContext
+	{
+		void *target;
+		bool failed;
+		string error;
+
+		explicit CallbackContext(void *aTarget)
+			: target(aTarget), failed(false)
+		{}
+
+		void fail()
+		{
+			failed = true;
+			try {
+				throw;
+			} catch (SQLite::Exception &ex) {
+#ifdef __BORLANDC__
+				error = ex.Message.c_str();
+#else
+				error = ex.getErrorMsg();
+#endif
+			} catch (...) {
+				error = "Unknown error in changeset callback";
+			}
+		}
+	};
+
+	int conflict_handler(void *aCtx, int aConflict, sqlite3_changeset_iter *aIter)
+	{
+		CallbackContext *ctx = reinterpret_cast<CallbackContext*>(aCtx);
+		try
+		{
+			const char *table = NULL;
+			int columns, op, indirect;
+			sqlite3changeset_op(aIter, &table, &columns, &op, &indirect);
+			return reinterpret_cast<SQLite::ConflictHandler*>(ctx->target)->conflict(aConflict, table, op);
+		}
+		catch (...)
+		{
+			ctx->fail();
+			return SQLITE_CHANGESET_ABORT;
+		}
+	}
+
+	int output_handler(void *aCtx, const void *aData, int aLength)
+	{
+		CallbackContext *ctx = reinterpret_cast<CallbackContext*>(aCtx);
+		try
+		{
+			reinterpret_cast<SQLite::ChangesetWriter*>(ctx->target)->write(aData, (unsigned)aLength);
+			return SQLITE_OK;
+		}
+		catch (...)
+		{
+			ctx->fail();
+			return SQLITE_ERROR;
+		}
+	}
+}
+
+namespace SQLite
+{
+	Changeset Changeset::invert() const
+	{
+		int length = 0;
+		void *out = NULL;
+		int rc = sqlite3changeset_invert((int)data.length(), (void*)data.data(), &length, &out);
+		if (rc != SQLITE_OK)
+		{
+			throw Exception(rc);
+		}
+		Changeset rv(out, (unsigned)length);
+		sqlite3_free(out);
+		return rv;
+	}
+	Changeset& Changeset::operator+=(const Changeset& c)
+	{
+		int length = 0;
+		void *out = NULL;
+		int rc = sqlite3changeset_concat(
+			(int)data.length(), (void*)data.data(),
+			(int)c.data.length(), (void*)c.data.data(),
+			&length, &out
+			);
+		if (rc != SQLITE_OK)
+		{
+			throw Exception(rc);
+		}
+		data.assign((const char*)out, (unsigned)length);
+		sqlite3_free(out);
+		return *this;
+	}
+
+	void Changeset::apply(DB& aTarget, ConflictPolicy aPolicy) const
+	{
+		PolicyHandler handler(aPolicy);
+		apply(aTarget, handler);
+	}
+	void Changeset::apply(DB& aTarget, ConflictHandler& aHandler) const
+	{
+		CallbackContext ctx(&aHandler);
+		int rc = sqlite3changeset_apply(
+			aTarget.ctx,
+			(int)data.length(), (void*)data.data(),
+			NULL,
+			conflict_handler,
+			&ctx
+			);
+		if (aTarget.changes)
+		{
+			// applying commits on its own outside of a transaction
+			aTarget.changes->settle(rc == SQLITE_OK ? SQLITE_DONE : rc);
+		}
+		if (ctx.failed)
+		{
+			throw Exception(ctx.error);
+		}
+		if (rc != SQLITE_OK)
+		{
+			// aborts leave no message on the connection
+			if (sqlite3_errcode(aTarget.ctx) == rc)
+			{
+				throw Exception(aTarget.ctx);
+			}
+			throw Exception(rc);
+		}
+	}
+
+	Session::Session(DB& aDB, const string& aSchema)
+		: db(aDB), session(NULL)
+	{
+		if (db.changes)
+		{
+			// the session would take over the stream's preupdate hook
+			throw Exception("Cannot record a session while changes are captured");
+		}
+		int rc = sqlite3session_create(db.ctx, aSchema.c_str(), &session);
+		if (rc != SQLITE_OK)
+		{
+			throw Exception(rc);
+		}
+		db.sessions++;
+	}
+	Session::~Session()
+	{
+		sqlite3session_delete(session);
+		db.sessions--;
+	}
+
+	void Session::attach(const string& aTable)
+	{
+		int rc = sqlite3session_attach(session, aTable.c_str());
+		if (rc != SQLITE_OK)
+		{
+			throw Exception(rc);
+		}
+	}
+	void Session::attachAll()
+	{
+		int rc = sqlite3session_attach(session, NULL);
+		if (rc != SQLITE_OK)
+		{
+			throw Exception(rc);
+		}
+	}
+	void Session::enable(bool aEnable)
+	{
+		sqlite3session_enable(session, aEnable ? 1 : 0);
+	}
+	bool Session::isEmpty()
+	{
+		return sqlite3session_isempty(session) != 0;
+	}
+
+	Changeset Session::changeset()
+	{
+		int length = 0;
+		void *out = NULL;
+		int rc = sqlite3session_changeset(session, &length, &out);
+		if (rc != SQLITE_OK)
+		{
+			throw Exception(rc);
+		}
+		Changeset rv(out, (unsigned)length);
+		sqlite3_free(out);
+		return rv;
+	}
+	Changeset Session::patchset()
+	{
+		int length = 0;
+		void *out = NULL;
+		int rc = sqlite3session_patchset(session, &length, &out);
+		if (rc != SQLITE_OK)
+		{
+			throw Exception(rc);
+		}
+		Changeset rv(out, (unsigned)length);
+		sqlite3_free(out);
+		return rv;
+	}
+	void Session::changeset(ChangesetWriter& aWriter)
+	{
+		CallbackContext ctx(&aWriter);
+		int rc = sqlite3session_changeset_strm(session, output_handler, &ctx);
+		if (ctx.failed)
+		{
+			throw Exception(ctx.error);
+		}
+		if (rc != SQLITE_OK)
+		{
+			throw Exception(rc);
+		}
+	}
+}
+
+#endif
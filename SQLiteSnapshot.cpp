@@ -0,0 +1,231 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteThread.h"
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+
+using namespace std;
+
+namespace
+{
+	class ScanThread : public SQLite::Thread
+	{
+	private:
+		SQLite::Snapshot& snapshot;
+		SQLite::DB& reader;
+		const string& query;
+		__int64 lower, upper;
+		unsigned part;
+		SQLite::RangeHandler& handler;
+
+	public:
+		bool failed;
+		string error;
+
+		ScanThread(
+			SQLite::Snapshot& aSnapshot,
+			SQLite::DB& aReader,
+			const string& aQuery,
+			__int64 aLower,
+			__int64 aUpper,
+			unsigned aPart,
+			SQLite::RangeHandler& aHandler
+			)
+			: snapshot(aSnapshot), reader(aReader), query(aQuery),
+			lower(aLower), upper(aUpper), part(aPart), handler(aHandler),
+			failed(false)
+		{}
+
+	protected:
+		virtual void run()
+		{
+			bool opened = false;
+			try
+			{
+				snapshot.open(reader);
+				opened = true;
+				{
+					SQLite::Stmt stmt = reader.prepare(query);
+					stmt.bind(1, lower);
+					stmt.bind(2, upper);
+					while (stmt.next())
+					{
+						handler.row(part, stmt);
+					}
+				}
+				opened = false;
+				snapshot.close(reader);
+			}
+			catch (SQLite::Exception &ex)
+			{
+				failed = true;
+#ifdef __BORLANDC__
+				error = ex.Message.c_str();
+#else
+				error = ex.getErrorMsg();
+#endif
+			}
+			catch (...)
+			{
+				failed = true;
+				error = "Unknown error during parallel scan";
+			}
+			if (opened)
+			{
+				try {
+					snapshot.close(reader);
+#ifdef __BORLANDC__
+				} catch (SQLite::Exception &ex) {
+#else
+				} catch (SQLite::Exception) {
+#endif
+				}
+			}
+		}
+	};
+}
+
+namespace SQLite
+{
+	Snapshot::Snapshot(DB& aSource, const string& aSchema)
+		: source(aSource), schema(aSchema), snap(NULL)
+	{
+		source.execute("BEGIN");
+		try
+		{
+			// snapshots may only be taken while a read transaction is open
+			Stmt stmt = source.prepare(
+				mprintf("SELECT 1 FROM \"%w\".sqlite_master LIMIT 1", schema.c_str())
+				);
+			stmt.next();
+			stmt.finalize();
+
+			int rc = sqlite3_snapshot_get(source.ctx, schema.c_str(), &snap);
+			if (rc != SQLITE_OK)
+			{
+				throw Exception(rc);
+			}
+		}
+		catch (...)
+		{
+			source.execute("ROLLBACK");
+			throw;
+		}
+	}
+	Snapshot::~Snapshot()
+	{
+		sqlite3_snapshot_free(snap);
+		try {
+			source.execute("COMMIT");
+#ifdef __BORLANDC__
+		} catch (SQLite::Exception &ex) {
+#else
+		} catch (SQLite::Exception) {
+#endif
+		}
+	}
+
+	void Snapshot::open(DB& aReader)
+	{
+		aReader.execute("BEGIN");
+		int rc = sqlite3_snapshot_open(aReader.ctx, schema.c_str(), snap);
+		if (rc != SQLITE_OK)
+		{
+			aReader.execute("ROLLBACK");
+			throw Exception(rc);
+		}
+	}
+	void Snapshot::close(DB& aReader)
+	{
+		aReader.execute("COMMIT");
+	}
+
+	void parallelScan(
+		Snapshot& aSnapshot,
+		ReaderList& readers,
+		const string& aTable,
+		const string& aQuery,
+		RangeHandler& handler
+		)
+	{
+		if (readers.empty())
+		{
+			throw Exception("No readers");
+		}
+
+		// the source connection already reads the snapshot
+		__int64 lower, upper;
+		{
+			Stmt stmt = aSnapshot.getSource().prepare(
+				mprintf(
+					"SELECT min(rowid), max(rowid) FROM \"%w\".\"%w\"",
+					aSnapshot.getSchema().c_str(),
+					aTable.c_str()
+					)
+				);
+			if (!stmt.next() || stmt[0].getType() == SQLITE_NULL)
+			{
+				return;
+			}
+			lower = stmt[0];
+			upper = stmt[1];
+		}
+
+		__int64 parts = (__int64)readers.size();
+		__int64 span = (upper - lower) / parts + 1;
+
+		vector<ScanThread*> threads;
+		try
+		{
+			for (unsigned i = 0; i < readers.size(); ++i)
+			{
+				__int64 from = lower + span * i;
+				if (from > upper)
+				{
+					break;
+				}
+				__int64 to = (i + 1 == readers.size()) ? upper : from + span - 1;
+				threads.push_back(new ScanThread(aSnapshot, *readers[i], aQuery, from, to, i, handler));
+				threads.back()->start();
+			}
+		}
+		catch (...)
+		{
+			for (unsigned i = 0; i < threads.size(); ++i)
+			{
+				threads[i]->join();
+				delete threads[i];
+			}
+			throw;
+		}
+
+		string error;
+		for (unsigned i = 0; i < threads.size(); ++i)
+		{
+			threads[i]->join();
+			if (threads[i]->failed && error.empty())
+			{
+				error = threads[i]->error;
+			}
+			delete threads[i];
+		}
+		if (!error.empty())
+		{
+			throw Exception(error);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,234 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteThread.h"
+
+using namespace std;
+
+namespace
+{
+	// counters restart when read with reset in between
+	inline int delta(int aNow, int aEarlier)
+	{
+		return aNow >= aEarlier ? aNow - aEarlier : aNow;
+	}
+
+	void dbStatus(sqlite3 *ctx, int aOp, bool aReset, int *aCurrent, int *aHighwater)
+	{
+		int current = 0, highwater = 0;
+		int rc = sqlite3_db_status(ctx, aOp, &current, &highwater, aReset ? 1 : 0);
+		if (rc != SQLITE_OK)
+		{
+			throw SQLite::Exception(rc);
+		}
+		if (aCurrent)
+		{
+			*aCurrent = current;
+		}
+		if (aHighwater)
+		{
+			*aHighwater = highwater;
+		}
+	}
+
+	void status(int aOp, bool aReset, __int64 *aCurrent, __int64 *aHighwater)
+	{
+		sqlite3_int64 current = 0, highwater = 0;
+		int rc = sqlite3_status64(aOp, &current, &highwater, aReset ? 1 : 0);
+		if (rc != SQLITE_OK)
+		{
+			throw SQLite::Exception(rc);
+		}
+		if (aCurrent)
+		{
+			*aCurrent = current;
+		}
+		if (aHighwater)
+		{
+			*aHighwater = highwater;
+		}
+	}
+}
+
+namespace SQLite
+{
+	volatile long busyWaits = 0;
+
+	DBStats DBStats::since(const DBStats& aEarlier) const
+	{
+		DBStats rv(*this);
+		rv.cacheHits = delta(cacheHits, aEarlier.cacheHits);
+		rv.cacheMisses = delta(cacheMisses, aEarlier.cacheMisses);
+		rv.cacheWrites = delta(cacheWrites, aEarlier.cacheWrites);
+		rv.cacheSpills = delta(cacheSpills, aEarlier.cacheSpills);
+		rv.lookasideHits = delta(lookasideHits, aEarlier.lookasideHits);
+		rv.lookasideMissSize = delta(lookasideMissSize, aEarlier.lookasideMissSize);
+		rv.lookasideMissFull = delta(lookasideMissFull, aEarlier.lookasideMissFull);
+		return rv;
+	}
+
+	DBStats DB::stats(bool aReset)
+	{
+		DBStats rv;
+		dbStatus(ctx, SQLITE_DBSTATUS_CACHE_USED, aReset, &rv.cacheUsed, NULL);
+		dbStatus(ctx, SQLITE_DBSTATUS_CACHE_USED_SHARED, aReset, &rv.cacheUsedShared, NULL);
+		dbStatus(ctx, SQLITE_DBSTATUS_CACHE_HIT, aReset, &rv.cacheHits, NULL);
+		dbStatus(ctx, SQLITE_DBSTATUS_CACHE_MISS, aReset, &rv.cacheMisses, NULL);
+		dbStatus(ctx, SQLITE_DBSTATUS_CACHE_WRITE, aReset, &rv.cacheWrites, NULL);
+#ifdef SQLITE_DBSTATUS_CACHE_SPILL
+		dbStatus(ctx, SQLITE_DBSTATUS_CACHE_SPILL, aReset, &rv.cacheSpills, NULL);
+#endif
+		// the lookaside counters are kept as high-water marks
+		dbStatus(ctx, SQLITE_DBSTATUS_LOOKASIDE_HIT, aReset, NULL, &rv.lookasideHits);
+		dbStatus(ctx, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, aReset, NULL, &rv.lookasideMissSize);
+		dbStatus(ctx, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, aReset, NULL, &rv.lookasideMissFull);
+		dbStatus(ctx, SQLITE_DBSTATUS_LOOKASIDE_USED, aReset, &rv.lookasideUsed, &rv.lookasideHighwater);
+		dbStatus(ctx, SQLITE_DBSTATUS_SCHEMA_USED, aReset, &rv.schemaUsed, NULL);
+		dbStatus(ctx, SQLITE_DBSTATUS_STMT_USED, aReset, &rv.stmtUsed, NULL);
+		return rv;
+	}
+
+	LibraryStats Library::stats(bool aReset)
+	{
+		LibraryStats rv;
+		status(SQLITE_STATUS_MEMORY_USED, aReset, &rv.memoryUsed, &rv.memoryHighwater);
+		status(SQLITE_STATUS_MALLOC_COUNT, aReset, &rv.mallocCount, &rv.mallocCountHighwater);
+		status(SQLITE_STATUS_MALLOC_SIZE, aReset, NULL, &rv.mallocSizeHighwater);
+		status(SQLITE_STATUS_PAGECACHE_SIZE, aReset, NULL, &rv.pagecacheSizeHighwater);
+		status(SQLITE_STATUS_PAGECACHE_USED, aReset, &rv.pagecacheUsed, &rv.pagecacheHighwater);
+		status(SQLITE_STATUS_PAGECACHE_OVERFLOW, aReset, &rv.pagecacheOverflow, &rv.pagecacheOverflowHighwater);
+		rv.busyWaits = atomicGet(&busyWaits);
+		if (aReset)
+		{
+			atomicAdd(&busyWaits, -(long)rv.busyWaits);
+		}
+		return rv;
+	}
+
+	class SamplerThread : public Thread
+	{
+	private:
+		StatsSampler& owner;
+
+	public:
+		explicit SamplerThread(StatsSampler& aOwner)
+			: owner(aOwner)
+		{}
+
+	protected:
+		virtual void run() { owner.run(); }
+	};
+
+	StatsSampler::StatsSampler(StatsSink& aSink, unsigned aIntervalMs)
+		: sink(aSink), intervalMs(aIntervalMs), thread(NULL), wake(NULL),
+		mutex(NULL), stopping(0)
+	{
+		wake = new Signal();
+		mutex = new Mutex();
+	}
+	StatsSampler::~StatsSampler()
+	{
+		stop();
+		delete mutex;
+		delete wake;
+	}
+
+	void StatsSampler::attach(DB& aDB)
+	{
+		DBStats stats = aDB.stats();
+		Lock lock(*mutex);
+		dbs.push_back(&aDB);
+		last.push_back(stats);
+	}
+	void StatsSampler::detach(DB& aDB)
+	{
+		Lock lock(*mutex);
+		for (unsigned i = 0; i < dbs.size(); ++i)
+		{
+			if (dbs[i] == &aDB)
+			{
+				dbs.erase(dbs.begin() + i);
+				last.erase(last.begin() + i);
+				return;
+			}
+		}
+	}
+
+	void StatsSampler::start()
+	{
+		if (thread)
+		{
+			return;
+		}
+		atomicSet(&stopping, 0);
+		thread = new SamplerThread(*this);
+		try
+		{
+			thread->start();
+		}
+		catch (...)
+		{
+			delete thread;
+			thread = NULL;
+			throw;
+		}
+	}
+	void StatsSampler::stop()
+	{
+		if (!thread)
+		{
+			return;
+		}
+		atomicSet(&stopping, 1);
+		wake->set();
+		thread->join();
+		delete thread;
+		thread = NULL;
+	}
+
+	void StatsSampler::run()
+	{
+		while (!atomicGet(&stopping))
+		{
+			wake->wait(intervalMs);
+			if (atomicGet(&stopping))
+			{
+				break;
+			}
+			try
+			{
+				sample();
+			}
+			catch (...)
+			{
+				// the next interval tries again
+			}
+		}
+	}
+
+	void StatsSampler::sample()
+	{
+		// held while calling the sink, so a connection is not detached
+		// and closed in between
+		Lock lock(*mutex);
+		for (unsigned i = 0; i < dbs.size(); ++i)
+		{
+			DBStats stats = dbs[i]->stats();
+			DBStats delta = stats.since(last[i]);
+			last[i] = stats;
+			sink.connection(*dbs[i], delta);
+		}
+		sink.library(Library::stats());
+	}
+}
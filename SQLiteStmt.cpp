@@ -12,27 +12,31 @@
 */
 
 #include "SQLite.h"
+#include "SQLiteCache.h"
+#include "SQLiteCheck.h"
+#include "SQLiteThread.h"
 
 #include <stdio.h>
+#include <algorithm>
 
 using namespace std;
 
 namespace SQLite
 {
 	Stmt::Stmt(DB& aOwner, const string &aQuery)
-		: owner(aOwner), query(aQuery), stmt(NULL)
+		: stmt(NULL), sql(aQuery), owner(aOwner), timeout(0), runStart(0), changeMark(0)
 	{
 		prepare();
 	}
 #ifdef __BORLANDC__
 	Stmt::Stmt(DB& aOwner, const AnsiString &aQuery)
-		: owner(aOwner), query(aQuery.c_str()), stmt(NULL)
+		: stmt(NULL), sql(aQuery.c_str()), owner(aOwner), timeout(0), runStart(0), changeMark(0)
 	{
 		prepare();
 	}
 #endif
 	Stmt::Stmt(const Stmt &c)
-		: owner(c.owner), query(c.query), stmt(NULL)
+		: stmt(NULL), sql(c.sql), owner(c.owner), timeout(c.timeout), runStart(0), changeMark(0)
 	{
 		prepare();
 	}
@@ -43,7 +47,8 @@ namespace SQLite
 	Stmt& Stmt::operator=(const Stmt &c)
 	{
 		owner = c.owner;
-		query = c.query;
+		sql = c.sql;
+		timeout = c.timeout;
 		finalize();
 		prepare();
 		return *this;
@@ -52,21 +57,46 @@ namespace SQLite
 	{			
 		done = ok = result = false;
 		const char *pTail = NULL;
-		if (sqlite3_prepare_v2(owner.ctx, query.c_str(), (int)query.length(), &stmt, &pTail) != SQLITE_OK)
+		tracked = owner.cache != NULL;
+		reads.clear();
+		if (tracked)
+		{
+			owner.cache->collect(&reads);
+		}
+		int rc = sqlite3_prepare_v2(owner.ctx, sql.c_str(), (int)sql.length(), &stmt, &pTail);
+		if (tracked)
+		{
+			owner.cache->collect(NULL);
+			sort(reads.begin(), reads.end());
+			reads.erase(unique(reads.begin(), reads.end()), reads.end());
+		}
+		if (rc != SQLITE_OK)
 		{
 			throw Exception(owner.ctx);
 		}
 		ok = true;	
+		params = (unsigned)sqlite3_bind_parameter_count(stmt);
+		bindings.assign(tracked ? params : 0, string());
 		if (pTail)
 		{
 			tail.assign(pTail);
 		}
+		if (owner.planChecker && stmt)
+		{
+			try
+			{
+				owner.checkPlan(*this);
+			}
+			catch (...)
+			{
+				// a throwing constructor does not run ~Stmt
+				sqlite3_finalize(stmt);
+				stmt = NULL;
+				ok = false;
+				throw;
+			}
+		}
 	}
-#ifndef NDEBUG
-#	define CHKTHROW if (!ok) { throw Exception("Statement unprepared!"); }
-#else
-#	define CHKTHROW
-#endif
 #define SQLOK(x) if (SQLITE_OK != x) throw Exception(owner.ctx);
 	void Stmt::check()
 	{
@@ -78,14 +108,37 @@ namespace SQLite
 	}
 	void Stmt::reset()
 	{
-		result = done = false;
 		CHKTHROW;
-		SQLOK(sqlite3_reset(stmt));
+		SQLOK(tryReset().getCode());
+	}
+	Status Stmt::tryReset()
+	{
+		result = done = false;
+		if (!ok)
+		{
+			return Status(SQLITE_MISUSE);
+		}
+		return Status(sqlite3_reset(stmt));
 	}
 	void Stmt::finalize()
 	{
 		if (ok)
 		{
+			if (owner.planChecker && stmt)
+			{
+				try
+				{
+					StmtStatus status = getStatus();
+					if (status.autoindexes)
+					{
+						owner.planChecker->autoIndexed(*this, status);
+					}
+				}
+				catch (...)
+				{
+					// runs from ~Stmt, nothing may escape
+				}
+			}
 			sqlite3_finalize(stmt);
 			stmt = NULL;
 		}
@@ -94,39 +147,132 @@ namespace SQLite
 	void Stmt::bind(unsigned idx)
 	{
 		CHKTHROW;
-		SQLOK(sqlite3_bind_null(stmt, idx));
+		SQLOK(tryBind(idx).getCode());
 	}
 	void Stmt::bind(unsigned idx, int value)
 	{
 		CHKTHROW;
-		SQLOK(sqlite3_bind_int(stmt, idx, value));
+		SQLOK(tryBind(idx, value).getCode());
 	}
 	void Stmt::bind(unsigned idx, const __int64& value)
 	{
 		CHKTHROW;
-		SQLOK(sqlite3_bind_int64(stmt, idx, value));
+		SQLOK(tryBind(idx, value).getCode());
 	}
 	void Stmt::bind(unsigned idx, const double& value)
 	{
 		CHKTHROW;
-		SQLOK(sqlite3_bind_double(stmt, idx, value));
+		SQLOK(tryBind(idx, value).getCode());
 	}
 	void Stmt::bind(unsigned idx, const string& value)
 	{
 		CHKTHROW;
-		SQLOK(sqlite3_bind_text(stmt, idx, value.c_str(), (int)value.length(), SQLITE_TRANSIENT));
+		SQLOK(tryBind(idx, value).getCode());
 	}
 #ifdef __BORLANDC__
 	void Stmt::bind(unsigned idx, const AnsiString& value)
 	{
 		CHKTHROW;
-		SQLOK(sqlite3_bind_text(stmt, idx, value.c_str(), value.Length(), SQLITE_TRANSIENT));
+		SQLOK(tryBind(idx, value).getCode());
 	}
 #endif
 	void Stmt::bind(unsigned idx, const void *value, unsigned length)
 	{
 		CHKTHROW;
-		SQLOK(sqlite3_bind_blob(stmt, idx, value, length, SQLITE_TRANSIENT));
+		SQLOK(tryBind(idx, value, length).getCode());
+	}
+	void Stmt::bind(unsigned idx, const char *value)
+	{
+		CHKTHROW;
+		SQLOK(tryBind(idx, value).getCode());
+	}
+	void Stmt::bind(unsigned idx, const Blob& value)
+	{
+		CHKTHROW;
+		SQLOK(tryBind(idx, value).getCode());
+	}
+	void Stmt::bind(unsigned idx, const StaticText& value)
+	{
+		CHKTHROW;
+		SQLOK(tryBind(idx, value).getCode());
+	}
+
+	Status Stmt::bound(int aCode, unsigned idx, int aType, const void *aData, unsigned aLength)
+	{
+		if (tracked && aCode == SQLITE_OK && idx >= 1 && idx <= bindings.size())
+		{
+			// type and length first, so that no two values encode alike
+			string& b = bindings[idx - 1];
+			b.assign(1, (char)aType);
+			b.append((const char*)&aLength, sizeof(aLength));
+			if (aLength)
+			{
+				b.append((const char*)aData, aLength);
+			}
+		}
+		return Status(aCode);
+	}
+	Status Stmt::tryBind(unsigned idx)
+	{
+		return bound(sqlite3_bind_null(stmt, idx), idx, SQLITE_NULL, NULL, 0);
+	}
+	Status Stmt::tryBind(unsigned idx, int value)
+	{
+		__int64 wide = value;
+		return bound(sqlite3_bind_int(stmt, idx, value), idx, SQLITE_INTEGER, &wide, sizeof(wide));
+	}
+	Status Stmt::tryBind(unsigned idx, const __int64& value)
+	{
+		return bound(sqlite3_bind_int64(stmt, idx, value), idx, SQLITE_INTEGER, &value, sizeof(value));
+	}
+	Status Stmt::tryBind(unsigned idx, const double& value)
+	{
+		return bound(sqlite3_bind_double(stmt, idx, value), idx, SQLITE_FLOAT, &value, sizeof(value));
+	}
+	Status Stmt::tryBind(unsigned idx, const string& value)
+	{
+		return bound(sqlite3_bind_text(stmt, idx, value.c_str(), (int)value.length(), SQLITE_TRANSIENT), idx, SQLITE_TEXT, value.data(), (unsigned)value.length());
+	}
+#ifdef __BORLANDC__
+	Status Stmt::tryBind(unsigned idx, const AnsiString& value)
+	{
+		return bound(sqlite3_bind_text(stmt, idx, value.c_str(), value.Length(), SQLITE_TRANSIENT), idx, SQLITE_TEXT, value.c_str(), (unsigned)value.Length());
+	}
+#endif
+	Status Stmt::tryBind(unsigned idx, const void *value, unsigned length)
+	{
+		return bound(sqlite3_bind_blob(stmt, idx, value, length, SQLITE_TRANSIENT), idx, SQLITE_BLOB, value, length);
+	}
+	Status Stmt::tryBind(unsigned idx, const char *value)
+	{
+		return bound(sqlite3_bind_text(stmt, idx, value, -1, SQLITE_TRANSIENT), idx, value ? SQLITE_TEXT : SQLITE_NULL, value, value ? (unsigned)strlen(value) : 0);
+	}
+	Status Stmt::tryBind(unsigned idx, const Blob& value)
+	{
+		return bound(sqlite3_bind_blob(stmt, idx, value.getData(), (int)value.getLength(), SQLITE_TRANSIENT), idx, SQLITE_BLOB, value.getData(), value.getLength());
+	}
+	Status Stmt::tryBind(unsigned idx, const StaticText& value)
+	{
+		return bound(sqlite3_bind_text(stmt, idx, value.getData(), (int)value.getLength(), SQLITE_STATIC), idx, SQLITE_TEXT, value.getData(), value.getLength());
+	}
+
+	void Stmt::beginBind(unsigned count)
+	{
+		CHKTHROW;
+		if (count != params)
+		{
+			throw Exception(mprintf("Expected %u parameters, got %u", params, count));
+		}
+		// rebinding requires a reset statement; the previous result is moot
+		result = done = false;
+		sqlite3_reset(stmt);
+	}
+	void Stmt::checkBind(const Status& rv)
+	{
+		if (!rv)
+		{
+			throw Exception(owner.ctx);
+		}
 	}
 
 	unsigned Stmt::getColumnCount()
@@ -147,14 +293,16 @@ namespace SQLite
 		{
 			throw Exception("Statement already done!");
 		}
-		int err = sqlite3_step(stmt);
-		if (err == SQLITE_DONE)
+		Status rv = tryNext();
+		if (rv.ok())
 		{
-			return (result = !(done = true));
+			return rv.hasRow();
 		}
-		else if (err == SQLITE_ROW)
+		if (rv.isInterrupt())
 		{
-			return (result = true);
+			bool timedOut = owner.timedOut;
+			owner.timedOut = false;
+			throw Interrupted(owner.ctx, timedOut);
 		}
 #if 0
 		FILE *fp = fopen("sqlite.except.log", "a");
@@ -169,6 +317,55 @@ namespace SQLite
 #endif
 		throw Exception(owner.ctx);
 	}
+	Status Stmt::tryNext()
+	{
+		if (!ok || done)
+		{
+			return Status(SQLITE_MISUSE);
+		}
+		owner.timedOut = false;
+		if (timeout)
+		{
+			if (!result)
+			{
+				runStart = clockMicros();
+			}
+			owner.stmtDeadline = runStart + (__int64)timeout * 1000;
+			owner.useProgressHandler();
+		}
+		if (!result)
+		{
+			changeMark = owner.changes ? owner.changes->mark() : 0;
+		}
+		int err = sqlite3_step(stmt);
+		owner.stmtDeadline = 0;
+		if (owner.changes)
+		{
+			owner.changes->settle(err);
+		}
+		if (err == SQLITE_DONE)
+		{
+			result = false;
+			done = true;
+		}
+		else if (err == SQLITE_ROW)
+		{
+			result = true;
+		}
+		else if (owner.changes)
+		{
+			// an aborted statement undoes its changes without calling any hook
+			owner.changes->discardFrom(changeMark);
+		}
+		return Status(err);
+	}
+	Status Stmt::tryExecute()
+	{
+		Status rv = tryNext();
+		// a failed step reports the same error again on reset
+		tryReset();
+		return rv;
+	}
 	void Stmt::executeMany(DataItr &dp, Trans::TransactionType aType)
 	{
 		Trans trans(owner, aType);
@@ -0,0 +1,231 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteThread.h"
+
+#ifndef SQLITEPP_WIN32_THREADS
+#	include <sys/time.h>
+#	include <time.h>
+#	include <errno.h>
+#endif
+
+using namespace std;
+
+namespace SQLite
+{
+#ifdef SQLITEPP_WIN32_THREADS
+	Mutex::Mutex() { InitializeCriticalSection(&cs); }
+	Mutex::~Mutex() { DeleteCriticalSection(&cs); }
+	void Mutex::lock() { EnterCriticalSection(&cs); }
+	void Mutex::unlock() { LeaveCriticalSection(&cs); }
+
+	Signal::Signal()
+	{
+		event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (!event)
+		{
+			throw Exception("Cannot create event");
+		}
+	}
+	Signal::~Signal() { CloseHandle(event); }
+	void Signal::set() { SetEvent(event); }
+	bool Signal::wait(unsigned ms)
+	{
+		return WaitForSingleObject(event, ms) == WAIT_OBJECT_0;
+	}
+	void Signal::wait() { WaitForSingleObject(event, INFINITE); }
+
+	Thread::Thread()
+		: handle(NULL)
+	{}
+	Thread::~Thread()
+	{
+		if (handle)
+		{
+			CloseHandle(handle);
+		}
+	}
+	DWORD WINAPI Thread::entry(LPVOID aThread)
+	{
+		reinterpret_cast<Thread*>(aThread)->run();
+		return 0;
+	}
+	void Thread::start()
+	{
+		if (handle)
+		{
+			throw Exception("Thread already started");
+		}
+		DWORD id;
+		handle = CreateThread(NULL, 0, entry, this, 0, &id);
+		if (!handle)
+		{
+			throw Exception("Cannot create thread");
+		}
+	}
+	void Thread::join()
+	{
+		if (handle)
+		{
+			WaitForSingleObject(handle, INFINITE);
+			CloseHandle(handle);
+			handle = NULL;
+		}
+	}
+
+	__int64 clockMicros()
+	{
+		static LARGE_INTEGER freq;
+		if (!freq.QuadPart)
+		{
+			QueryPerformanceFrequency(&freq);
+		}
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		return (__int64)(now.QuadPart / (double)freq.QuadPart * 1000000.0);
+	}
+
+	long atomicAdd(volatile long *aValue, long aDelta)
+	{
+		return InterlockedExchangeAdd((LPLONG)aValue, aDelta) + aDelta;
+	}
+	long atomicGet(volatile long *aValue)
+	{
+		return InterlockedExchangeAdd((LPLONG)aValue, 0);
+	}
+	void atomicSet(volatile long *aValue, long aNew)
+	{
+		InterlockedExchange((LPLONG)aValue, aNew);
+	}
+#else
+	Mutex::Mutex() { pthread_mutex_init(&mtx, NULL); }
+	Mutex::~Mutex() { pthread_mutex_destroy(&mtx); }
+	void Mutex::lock() { pthread_mutex_lock(&mtx); }
+	void Mutex::unlock() { pthread_mutex_unlock(&mtx); }
+
+	Signal::Signal()
+		: signalled(false)
+	{
+		pthread_mutex_init(&mtx, NULL);
+		pthread_cond_init(&cond, NULL);
+	}
+	Signal::~Signal()
+	{
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mtx);
+	}
+	void Signal::set()
+	{
+		pthread_mutex_lock(&mtx);
+		signalled = true;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mtx);
+	}
+	bool Signal::wait(unsigned ms)
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		struct timespec until;
+		until.tv_sec = now.tv_sec + ms / 1000;
+		until.tv_nsec = now.tv_usec * 1000 + (ms % 1000) * 1000000;
+		if (until.tv_nsec >= 1000000000)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+
+		pthread_mutex_lock(&mtx);
+		int err = 0;
+		while (!signalled && err != ETIMEDOUT)
+		{
+			err = pthread_cond_timedwait(&cond, &mtx, &until);
+		}
+		bool rv = signalled;
+		signalled = false;
+		pthread_mutex_unlock(&mtx);
+		return rv;
+	}
+	void Signal::wait()
+	{
+		pthread_mutex_lock(&mtx);
+		while (!signalled)
+		{
+			pthread_cond_wait(&cond, &mtx);
+		}
+		signalled = false;
+		pthread_mutex_unlock(&mtx);
+	}
+
+	Thread::Thread()
+		: started(false)
+	{}
+	Thread::~Thread()
+	{
+		if (started)
+		{
+			pthread_detach(handle);
+		}
+	}
+	void *Thread::entry(void *aThread)
+	{
+		reinterpret_cast<Thread*>(aThread)->run();
+		return NULL;
+	}
+	void Thread::start()
+	{
+		if (started)
+		{
+			throw Exception("Thread already started");
+		}
+		if (pthread_create(&handle, NULL, entry, this) != 0)
+		{
+			throw Exception("Cannot create thread");
+		}
+		started = true;
+	}
+	void Thread::join()
+	{
+		if (started)
+		{
+			pthread_join(handle, NULL);
+			started = false;
+		}
+	}
+
+	__int64 clockMicros()
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (__int64)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	}
+
+	long atomicAdd(volatile long *aValue, long aDelta)
+	{
+		return __sync_add_and_fetch(aValue, aDelta);
+	}
+	long atomicGet(volatile long *aValue)
+	{
+		return __sync_fetch_and_add(aValue, 0);
+	}
+	void atomicSet(volatile long *aValue, long aNew)
+	{
+		// a full barrier exchange, like InterlockedExchange
+		long old = 0, prev;
+		while ((prev = __sync_val_compare_and_swap(aValue, old, aNew)) != old)
+		{
+			old = prev;
+		}
+	}
+#endif
+}
@@ -0,0 +1,132 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+/* $Id$ */
+
+/*
+** Minimal portable threading primitives used internally by the wrapper.
+** Not part of the public interface; include SQLite.h instead.
+*/
+
+#ifndef _SQLITEPP_THREAD_H
+#define _SQLITEPP_THREAD_H
+
+#ifdef MSVC
+#pragma once
+#endif
+
+#if defined(_WIN32) || defined(WIN32) || defined(__CYGWIN__) || defined(__MINGW32__) || defined(__BORLANDC__)
+#	include <windows.h>
+#	define SQLITEPP_WIN32_THREADS
+#else
+#	include <pthread.h>
+#endif
+
+namespace SQLite
+{
+	class Mutex
+	{
+	private:
+#ifdef SQLITEPP_WIN32_THREADS
+		CRITICAL_SECTION cs;
+#else
+		pthread_mutex_t mtx;
+#endif
+		friend class Signal;
+
+		Mutex(const Mutex&);
+		Mutex& operator=(const Mutex&);
+
+	public:
+		Mutex();
+		~Mutex();
+
+		void lock();
+		void unlock();
+	};
+
+	class Lock
+	{
+	private:
+		Mutex& mutex;
+
+		Lock(const Lock&);
+		Lock& operator=(const Lock&);
+
+	public:
+		explicit Lock(Mutex& aMutex) : mutex(aMutex) { mutex.lock(); }
+		~Lock() { mutex.unlock(); }
+	};
+
+	// Auto-reset event: set() wakes a single wait()
+	class Signal
+	{
+	private:
+#ifdef SQLITEPP_WIN32_THREADS
+		HANDLE event;
+#else
+		pthread_mutex_t mtx;
+		pthread_cond_t cond;
+		bool signalled;
+#endif
+
+		Signal(const Signal&);
+		Signal& operator=(const Signal&);
+
+	public:
+		Signal();
+		~Signal();
+
+		void set();
+		// Returns false on timeout
+		bool wait(unsigned ms);
+		void wait();
+	};
+
+	class Thread
+	{
+	private:
+#ifdef SQLITEPP_WIN32_THREADS
+		HANDLE handle;
+		static DWORD WINAPI entry(LPVOID aThread);
+#else
+		pthread_t handle;
+		bool started;
+		static void *entry(void *aThread);
+#endif
+
+		Thread(const Thread&);
+		Thread& operator=(const Thread&);
+
+	protected:
+		virtual void run() = 0;
+
+	public:
+		Thread();
+		virtual ~Thread();
+
+		void start();
+		void join();
+	};
+
+	// Monotonic clock in microseconds
+	__int64 clockMicros();
+
+	// Returns the new value
+	long atomicAdd(volatile long *aValue, long aDelta);
+	long atomicGet(volatile long *aValue);
+	void atomicSet(volatile long *aValue, long aNew);
+
+	// Retries by the busy handler, see Library::stats()
+	extern volatile long busyWaits;
+}
+#endif
@@ -0,0 +1,429 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define SQLITEPP_SSE2
+#endif
+#ifdef SQLITEPP_SSE2
+#	if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#		include <immintrin.h>
+#		define SQLITEPP_AVX2
+#		define AVX2_TARGET __attribute__((target("avx2,fma")))
+#	elif defined(_MSC_VER) && _MSC_VER >= 1700
+#		include <immintrin.h>
+#		include <intrin.h>
+#		define SQLITEPP_AVX2
+#		define AVX2_TARGET
+#	endif
+#endif
+
+using namespace std;
+
+namespace
+{
+	// Kernels over n floats at possibly unaligned addresses
+	struct Kernels
+	{
+		const char *name;
+		float (*dot)(const float *a, const float *b, unsigned n);
+		// squared euclidean distance
+		float (*l2)(const float *a, const float *b, unsigned n);
+		void (*cosine)(const float *a, const float *b, unsigned n, float *ab, float *aa, float *bb);
+	};
+
+	inline float load(const float *p)
+	{
+		float rv;
+		memcpy(&rv, p, sizeof(rv));
+		return rv;
+	}
+
+	float dotScalar(const float *a, const float *b, unsigned n)
+	{
+		float rv = 0;
+		for (unsigned i = 0; i < n; ++i)
+		{
+			rv += load(a + i) * load(b + i);
+		}
+		return rv;
+	}
+	float l2Scalar(const float *a, const float *b, unsigned n)
+	{
+		float rv = 0;
+		for (unsigned i = 0; i < n; ++i)
+		{
+			float d = load(a + i) - load(b + i);
+			rv += d * d;
+		}
+		return rv;
+	}
+	void cosineScalar(const float *a, const float *b, unsigned n, float *ab, float *aa, float *bb)
+	{
+		float sab = 0, saa = 0, sbb = 0;
+		for (unsigned i = 0; i < n; ++i)
+		{
+			float x = load(a + i), y = load(b + i);
+			sab += x * y;
+			saa += x * x;
+			sbb += y * y;
+		}
+		*ab = sab;
+		*aa = saa;
+		*bb = sbb;
+	}
+	const Kernels scalar = { "scalar", dotScalar, l2Scalar, cosineScalar };
+
+#ifdef SQLITEPP_SSE2
+	inline float sum(__m128 v)
+	{
+		v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+		return _mm_cvtss_f32(v);
+	}
+
+	float dotSse2(const float *a, const float *b, unsigned n)
+	{
+		__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+		unsigned i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+			s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+		}
+		return sum(_mm_add_ps(s0, s1)) + dotScalar(a + i, b + i, n - i);
+	}
+	float l2Sse2(const float *a, const float *b, unsigned n)
+	{
+		__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+		unsigned i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+			__m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+			s0 = _mm_add_ps(s0, _mm_mul_ps(d0, d0));
+			s1 = _mm_add_ps(s1, _mm_mul_ps(d1, d1));
+		}
+		return sum(_mm_add_ps(s0, s1)) + l2Scalar(a + i, b + i, n - i);
+	}
+	void cosineSse2(const float *a, const float *b, unsigned n, float *ab, float *aa, float *bb)
+	{
+		__m128 sab = _mm_setzero_ps(), saa = _mm_setzero_ps(), sbb = _mm_setzero_ps();
+		unsigned i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(a + i), y = _mm_loadu_ps(b + i);
+			sab = _mm_add_ps(sab, _mm_mul_ps(x, y));
+			saa = _mm_add_ps(saa, _mm_mul_ps(x, x));
+			sbb = _mm_add_ps(sbb, _mm_mul_ps(y, y));
+		}
+		cosineScalar(a + i, b + i, n - i, ab, aa, bb);
+		*ab += sum(sab);
+		*aa += sum(saa);
+		*bb += sum(sbb);
+	}
+	const Kernels sse2 = { "sse2", dotSse2, l2Sse2, cosineSse2 };
+#endif
+
+#ifdef SQLITEPP_AVX2
+	AVX2_TARGET inline float sum(__m256 v)
+	{
+		return sum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+	}
+
+	AVX2_TARGET float dotAvx2(const float *a, const float *b, unsigned n)
+	{
+		__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+		unsigned i = 0;
+		for (; i + 16 <= n; i += 16)
+		{
+			s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+			s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+		}
+		return sum(_mm256_add_ps(s0, s1)) + dotSse2(a + i, b + i, n - i);
+	}
+	AVX2_TARGET float l2Avx2(const float *a, const float *b, unsigned n)
+	{
+		__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+		unsigned i = 0;
+		for (; i + 16 <= n; i += 16)
+		{
+			__m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+			__m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+			s0 = _mm256_fmadd_ps(d0, d0, s0);
+			s1 = _mm256_fmadd_ps(d1, d1, s1);
+		}
+		return sum(_mm256_add_ps(s0, s1)) + l2Sse2(a + i, b + i, n - i);
+	}
+	AVX2_TARGET void cosineAvx2(const float *a, const float *b, unsigned n, float *ab, float *aa, float *bb)
+	{
+		__m256 sab = _mm256_setzero_ps(), saa = _mm256_setzero_ps(), sbb = _mm256_setzero_ps();
+		unsigned i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256 x = _mm256_loadu_ps(a + i), y = _mm256_loadu_ps(b + i);
+			sab = _mm256_fmadd_ps(x, y, sab);
+			saa = _mm256_fmadd_ps(x, x, saa);
+			sbb = _mm256_fmadd_ps(y, y, sbb);
+		}
+		cosineSse2(a + i, b + i, n - i, ab, aa, bb);
+		*ab += sum(sab);
+		*aa += sum(saa);
+		*bb += sum(sbb);
+	}
+	const Kernels avx2 = { "avx2", dotAvx2, l2Avx2, cosineAvx2 };
+
+	bool hasAvx2()
+	{
+#if defined(__GNUC__)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+		int info[4];
+		__cpuid(info, 1);
+		// FMA, OSXSAVE and AVX, with the OS saving the YMM registers
+		const int features = (1 << 12) | (1 << 27) | (1 << 28);
+		if ((info[2] & features) != features || (_xgetbv(0) & 6) != 6)
+		{
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#endif
+	}
+#endif
+
+	const Kernels& pick()
+	{
+#ifdef SQLITEPP_AVX2
+		if (hasAvx2())
+		{
+			return avx2;
+		}
+#endif
+#ifdef SQLITEPP_SSE2
+		return sse2;
+#else
+		return scalar;
+#endif
+	}
+	const Kernels& kernels = pick();
+
+	// Both arguments as float vectors of the same length, read in place.
+	// Returns false if a result (NULL or an error) was already set.
+	bool vectors(sqlite3_context *ctx, sqlite3_value **vals, const float **a, const float **b, unsigned *n)
+	{
+		int ta = sqlite3_value_type(vals[0]), tb = sqlite3_value_type(vals[1]);
+		if (ta == SQLITE_NULL || tb == SQLITE_NULL)
+		{
+			sqlite3_result_null(ctx);
+			return false;
+		}
+		if (ta != SQLITE_BLOB || tb != SQLITE_BLOB)
+		{
+			sqlite3_result_error(ctx, "vectors must be float32 blobs", -1);
+			return false;
+		}
+		*a = (const float*)sqlite3_value_blob(vals[0]);
+		*b = (const float*)sqlite3_value_blob(vals[1]);
+		int la = sqlite3_value_bytes(vals[0]), lb = sqlite3_value_bytes(vals[1]);
+		if (la != lb || la % sizeof(float))
+		{
+			sqlite3_result_error(ctx, "vectors must be float32 blobs of the same length", -1);
+			return false;
+		}
+		*n = (unsigned)la / sizeof(float);
+		return true;
+	}
+
+	void vecDot(sqlite3_context *ctx, int, sqlite3_value **vals)
+	{
+		const float *a, *b;
+		unsigned n;
+		if (vectors(ctx, vals, &a, &b, &n))
+		{
+			sqlite3_result_double(ctx, kernels.dot(a, b, n));
+		}
+	}
+	void vecCosine(sqlite3_context *ctx, int, sqlite3_value **vals)
+	{
+		const float *a, *b;
+		unsigned n;
+		if (vectors(ctx, vals, &a, &b, &n))
+		{
+			float ab = 0, aa = 0, bb = 0;
+			kernels.cosine(a, b, n, &ab, &aa, &bb);
+			if (aa == 0 || bb == 0)
+			{
+				sqlite3_result_null(ctx);
+				return;
+			}
+			sqlite3_result_double(ctx, ab / sqrt((double)aa * bb));
+		}
+	}
+	void vecL2(sqlite3_context *ctx, int, sqlite3_value **vals)
+	{
+		const float *a, *b;
+		unsigned n;
+		if (vectors(ctx, vals, &a, &b, &n))
+		{
+			sqlite3_result_double(ctx, sqrt((double)kernels.l2(a, b, n)));
+		}
+	}
+
+	struct Candidate
+	{
+		double score;
+		sqlite3_int64 id;
+	};
+	// Ties go to the lower id. As the heap order, it keeps the worst
+	// candidate on top.
+	bool better(const Candidate& x, const Candidate& y)
+	{
+		return x.score > y.score || (x.score == y.score && x.id < y.id);
+	}
+	struct TopK
+	{
+		unsigned k;
+		vector<Candidate> heap;
+	};
+
+	void topkStep(sqlite3_context *ctx, int, sqlite3_value **vals)
+	{
+		TopK **state = (TopK**)sqlite3_aggregate_context(ctx, sizeof(TopK*));
+		if (!state)
+		{
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		try
+		{
+			if (!*state)
+			{
+				sqlite3_int64 k = sqlite3_value_int64(vals[0]);
+				if (k <= 0 || k > 0x7fffffff)
+				{
+					sqlite3_result_error(ctx, "vec_topk: k must be positive", -1);
+					return;
+				}
+				*state = new TopK;
+				(*state)->k = (unsigned)k;
+				(*state)->heap.reserve((unsigned)min(k, (sqlite3_int64)1024));
+			}
+			if (sqlite3_value_type(vals[1]) == SQLITE_NULL || sqlite3_value_type(vals[2]) == SQLITE_NULL)
+			{
+				return;
+			}
+			Candidate c;
+			c.id = sqlite3_value_int64(vals[1]);
+			c.score = sqlite3_value_double(vals[2]);
+
+			vector<Candidate>& heap = (*state)->heap;
+			if (heap.size() < (*state)->k)
+			{
+				heap.push_back(c);
+				push_heap(heap.begin(), heap.end(), better);
+			}
+			else if (better(c, heap.front()))
+			{
+				pop_heap(heap.begin(), heap.end(), better);
+				heap.back() = c;
+				push_heap(heap.begin(), heap.end(), better);
+			}
+		}
+		catch (...)
+		{
+			sqlite3_result_error_nomem(ctx);
+		}
+	}
+	void topkFinal(sqlite3_context *ctx)
+	{
+		TopK **state = (TopK**)sqlite3_aggregate_context(ctx, 0);
+		TopK *topk = state ? *state : NULL;
+		try
+		{
+			string rv = "[";
+			if (topk)
+			{
+				sort_heap(topk->heap.begin(), topk->heap.end(), better);
+				for (unsigned i = 0; i < topk->heap.size(); ++i)
+				{
+					if (i)
+					{
+						rv += ",";
+					}
+					rv += SQLite::mprintf("%lld", topk->heap[i].id);
+				}
+			}
+			rv += "]";
+			sqlite3_result_text(ctx, rv.c_str(), (int)rv.length(), SQLITE_TRANSIENT);
+		}
+		catch (...)
+		{
+			sqlite3_result_error_nomem(ctx);
+		}
+		delete topk;
+	}
+}
+
+namespace SQLite
+{
+	const char *vectorKernel()
+	{
+		return kernels.name;
+	}
+
+	void DB::registerVectorFunctions()
+	{
+		static const struct
+		{
+			const char *name;
+			void (*func)(sqlite3_context *, int, sqlite3_value **);
+		} scalars[] = {
+			{ "vec_dot", vecDot },
+			{ "vec_cosine", vecCosine },
+			{ "vec_l2", vecL2 }
+		};
+		for (unsigned i = 0; i < sizeof(scalars) / sizeof(scalars[0]); ++i)
+		{
+			if (SQLITE_OK != sqlite3_create_function(
+				ctx, scalars[i].name,
+				2,
+				SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+				scalars[i].func,
+				NULL,
+				NULL
+			))
+			{
+				throw Exception(ctx);
+			}
+		}
+		if (SQLITE_OK != sqlite3_create_function(
+			ctx, "vec_topk",
+			3,
+			SQLITE_UTF8, NULL,
+			NULL,
+			topkStep,
+			topkFinal
+		))
+		{
+			throw Exception(ctx);
+		}
+	}
+}
@@ -0,0 +1,624 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+#include "SQLite.h"
+#include "SQLiteThread.h"
+
+#include <string.h>
+
+using namespace std;
+
+namespace SQLite
+{
+	// Counters of one open file; only its own connection writes them
+	class IoCounters
+	{
+	public:
+		Mutex mutex;
+		int type;
+		IoStats stats;
+	};
+
+	class StatsVfsShim
+	{
+	public:
+		enum Type
+		{
+			DB_FILE,
+			WAL_FILE,
+			JOURNAL_FILE,
+			OTHER_FILE
+		};
+		enum Op
+		{
+			READ,
+			WRITE,
+			SYNC,
+			READ_AHEAD,
+			READ_AHEAD_HIT
+		};
+
+		enum
+		{
+			// sequential reads before reading ahead
+			RUN = 4,
+			MIN_WINDOW = 64 * 1024,
+			MAX_WINDOW = 1024 * 1024
+		};
+
+		struct File
+		{
+			sqlite3_file base;
+			StatsVfs *owner;
+			IoCounters *counters;
+			int type;
+			bool readAhead;
+			// offset after the last read and sequential reads up to it
+			sqlite3_int64 next;
+			unsigned run;
+			int window;
+			char *buffer;
+			sqlite3_int64 bufferStart;
+			int bufferLength;
+			// followed by the file of the parent VFS
+		};
+
+		static sqlite3_file *real(sqlite3_file *aFile)
+		{
+			return (sqlite3_file*)(((File*)aFile) + 1);
+		}
+		static StatsVfs *owner(sqlite3_vfs *aVfs)
+		{
+			return (StatsVfs*)aVfs->pAppData;
+		}
+
+		static const sqlite3_io_methods methods;
+
+		static IoStats& pick(VfsStats& aStats, int aType)
+		{
+			switch (aType)
+			{
+				case DB_FILE:
+					return aStats.db;
+				case WAL_FILE:
+					return aStats.wal;
+				case JOURNAL_FILE:
+					return aStats.journal;
+				default:
+					return aStats.other;
+			}
+		}
+		static void add(IoStats& aTotal, const IoStats& aFile)
+		{
+			aTotal.reads += aFile.reads;
+			aTotal.writes += aFile.writes;
+			aTotal.syncs += aFile.syncs;
+			aTotal.bytesRead += aFile.bytesRead;
+			aTotal.bytesWritten += aFile.bytesWritten;
+			aTotal.readMicros += aFile.readMicros;
+			aTotal.writeMicros += aFile.writeMicros;
+			aTotal.syncMicros += aFile.syncMicros;
+			aTotal.readAheads += aFile.readAheads;
+			aTotal.readAheadHits += aFile.readAheadHits;
+		}
+
+		static void record(File *f, int aOp, __int64 aBytes, __int64 aMicros)
+		{
+			// the file's own lock, only contended while reading the stats
+			Lock lock(f->counters->mutex);
+			IoStats *s = &f->counters->stats;
+			switch (aOp)
+			{
+				case READ:
+					++s->reads;
+					s->bytesRead += aBytes;
+					s->readMicros += aMicros;
+					break;
+				case WRITE:
+					++s->writes;
+					s->bytesWritten += aBytes;
+					s->writeMicros += aMicros;
+					break;
+				case SYNC:
+					++s->syncs;
+					s->syncMicros += aMicros;
+					break;
+				case READ_AHEAD:
+					++s->reads;
+					++s->readAheads;
+					s->bytesRead += aBytes;
+					s->readMicros += aMicros;
+					break;
+				default:
+					++s->readAheadHits;
+					break;
+			}
+		}
+
+		static IoCounters *track(StatsVfs *aVfs, int aType)
+		{
+			IoCounters *rv = NULL;
+			try
+			{
+				rv = new IoCounters;
+				rv->type = aType;
+				Lock lock(*aVfs->mutex);
+				aVfs->files.push_back(rv);
+			}
+			catch (...)
+			{
+				delete rv;
+				return NULL;
+			}
+			return rv;
+		}
+		static void untrack(StatsVfs *aVfs, IoCounters *aCounters)
+		{
+			{
+				Lock lock(*aVfs->mutex);
+				add(pick(aVfs->stats, aCounters->type), aCounters->stats);
+				for (unsigned i = 0; i < aVfs->files.size(); ++i)
+				{
+					if (aVfs->files[i] == aCounters)
+					{
+						aVfs->files.erase(aVfs->files.begin() + i);
+						break;
+					}
+				}
+			}
+			delete aCounters;
+		}
+
+		static int xClose(sqlite3_file *aFile)
+		{
+			File *f = (File*)aFile;
+			sqlite3_free(f->buffer);
+			f->buffer = NULL;
+			if (f->counters)
+			{
+				untrack(f->owner, f->counters);
+				f->counters = NULL;
+			}
+			sqlite3_file *r = real(aFile);
+			return r->pMethods ? r->pMethods->xClose(r) : SQLITE_OK;
+		}
+
+		// Another connection may have changed the file
+		static void invalidate(sqlite3_file *aFile)
+		{
+			((File*)aFile)->bufferLength = 0;
+		}
+
+		// Fills the buffer starting at aOffset; false if that did not
+		// cover aAmount bytes
+		static bool fill(File *f, sqlite3_file *r, sqlite3_int64 aOffset, int aAmount)
+		{
+			if (!f->buffer)
+			{
+				f->buffer = (char*)sqlite3_malloc(MAX_WINDOW);
+				if (!f->buffer)
+				{
+					return false;
+				}
+			}
+			if (f->window < aAmount)
+			{
+				return false;
+			}
+			__int64 start = clockMicros();
+			int rc = r->pMethods->xRead(r, f->buffer, f->window, aOffset);
+			int length = f->window;
+			if (rc == SQLITE_IOERR_SHORT_READ)
+			{
+				sqlite3_int64 size = 0;
+				rc = r->pMethods->xFileSize(r, &size);
+				length = size > aOffset ? (int)(size - aOffset < f->window ? size - aOffset : f->window) : 0;
+			}
+			record(f, READ_AHEAD, rc == SQLITE_OK ? length : 0, clockMicros() - start);
+			if (rc != SQLITE_OK || length < aAmount)
+			{
+				f->bufferLength = 0;
+				return false;
+			}
+			f->bufferStart = aOffset;
+			f->bufferLength = length;
+			if (f->window < MAX_WINDOW)
+			{
+				f->window *= 2;
+			}
+			return true;
+		}
+
+		static int xRead(sqlite3_file *aFile, void *aBuffer, int aAmount, sqlite3_int64 aOffset)
+		{
+			File *f = (File*)aFile;
+			sqlite3_file *r = real(aFile);
+			if (f->readAhead)
+			{
+				if (aOffset == f->next)
+				{
+					++f->run;
+				}
+				else
+				{
+					f->run = 0;
+					f->window = MIN_WINDOW;
+				}
+				f->next = aOffset + aAmount;
+
+				bool buffered = f->bufferLength &&
+					aOffset >= f->bufferStart &&
+					aOffset + aAmount <= f->bufferStart + f->bufferLength;
+				if (buffered)
+				{
+					record(f, READ_AHEAD_HIT, 0, 0);
+				}
+				else if (f->run >= RUN)
+				{
+					buffered = fill(f, r, aOffset, aAmount);
+				}
+				if (buffered)
+				{
+					memcpy(aBuffer, f->buffer + (aOffset - f->bufferStart), aAmount);
+					return SQLITE_OK;
+				}
+			}
+			__int64 start = clockMicros();
+			int rc = r->pMethods->xRead(r, aBuffer, aAmount, aOffset);
+			record(f, READ, rc == SQLITE_OK ? aAmount : 0, clockMicros() - start);
+			return rc;
+		}
+		static int xWrite(sqlite3_file *aFile, const void *aBuffer, int aAmount, sqlite3_int64 aOffset)
+		{
+			File *f = (File*)aFile;
+			sqlite3_file *r = real(aFile);
+			invalidate(aFile);
+			__int64 start = clockMicros();
+			int rc = r->pMethods->xWrite(r, aBuffer, aAmount, aOffset);
+			record(f, WRITE, rc == SQLITE_OK ? aAmount : 0, clockMicros() - start);
+			return rc;
+		}
+		static int xTruncate(sqlite3_file *aFile, sqlite3_int64 aSize)
+		{
+			sqlite3_file *r = real(aFile);
+			invalidate(aFile);
+			return r->pMethods->xTruncate(r, aSize);
+		}
+		static int xSync(sqlite3_file *aFile, int aFlags)
+		{
+			File *f = (File*)aFile;
+			sqlite3_file *r = real(aFile);
+			__int64 start = clockMicros();
+			int rc = r->pMethods->xSync(r, aFlags);
+			record(f, SYNC, 0, clockMicros() - start);
+			return rc;
+		}
+		static int xFileSize(sqlite3_file *aFile, sqlite3_int64 *aSize)
+		{
+			sqlite3_file *r = real(aFile);
+			return r->pMethods->xFileSize(r, aSize);
+		}
+		static int xLock(sqlite3_file *aFile, int aLock)
+		{
+			sqlite3_file *r = real(aFile);
+			invalidate(aFile);
+			return r->pMethods->xLock(r, aLock);
+		}
+		static int xUnlock(sqlite3_file *aFile, int aLock)
+		{
+			sqlite3_file *r = real(aFile);
+			invalidate(aFile);
+			return r->pMethods->xUnlock(r, aLock);
+		}
+		static int xCheckReservedLock(sqlite3_file *aFile, int *aResult)
+		{
+			sqlite3_file *r = real(aFile);
+			return r->pMethods->xCheckReservedLock(r, aResult);
+		}
+		static int xFileControl(sqlite3_file *aFile, int aOp, void *aArg)
+		{
+			sqlite3_file *r = real(aFile);
+			int rc = r->pMethods->xFileControl(r, aOp, aArg);
+			if (aOp == SQLITE_FCNTL_VFSNAME && rc == SQLITE_OK)
+			{
+				// reported as "stats/unix"
+				StatsVfs *vfs = ((File*)aFile)->owner;
+				char **name = (char**)aArg;
+				*name = sqlite3_mprintf("%s/%z", vfs->name.c_str(), *name);
+			}
+			return rc;
+		}
+		static int xSectorSize(sqlite3_file *aFile)
+		{
+			sqlite3_file *r = real(aFile);
+			return r->pMethods->xSectorSize(r);
+		}
+		static int xDeviceCharacteristics(sqlite3_file *aFile)
+		{
+			sqlite3_file *r = real(aFile);
+			return r->pMethods->xDeviceCharacteristics(r);
+		}
+		static int xShmMap(sqlite3_file *aFile, int aPage, int aPageSize, int aExtend, void volatile **aOut)
+		{
+			sqlite3_file *r = real(aFile);
+			if (r->pMethods->iVersion < 2)
+			{
+				return SQLITE_IOERR_SHMMAP;
+			}
+			return r->pMethods->xShmMap(r, aPage, aPageSize, aExtend, aOut);
+		}
+		static int xShmLock(sqlite3_file *aFile, int aOffset, int aCount, int aFlags)
+		{
+			sqlite3_file *r = real(aFile);
+			// in WAL mode, read transactions start here
+			invalidate(aFile);
+			if (r->pMethods->iVersion < 2)
+			{
+				return SQLITE_IOERR_SHMLOCK;
+			}
+			return r->pMethods->xShmLock(r, aOffset, aCount, aFlags);
+		}
+		static void xShmBarrier(sqlite3_file *aFile)
+		{
+			sqlite3_file *r = real(aFile);
+			if (r->pMethods->iVersion >= 2)
+			{
+				r->pMethods->xShmBarrier(r);
+			}
+		}
+		static int xShmUnmap(sqlite3_file *aFile, int aDelete)
+		{
+			sqlite3_file *r = real(aFile);
+			if (r->pMethods->iVersion < 2)
+			{
+				return SQLITE_OK;
+			}
+			return r->pMethods->xShmUnmap(r, aDelete);
+		}
+		static int xFetch(sqlite3_file *aFile, sqlite3_int64 aOffset, int aAmount, void **aOut)
+		{
+			sqlite3_file *r = real(aFile);
+			if (r->pMethods->iVersion < 3)
+			{
+				*aOut = NULL;
+				return SQLITE_OK;
+			}
+			// memory-mapped pages bypass xRead and are not counted
+			return r->pMethods->xFetch(r, aOffset, aAmount, aOut);
+		}
+		static int xUnfetch(sqlite3_file *aFile, sqlite3_int64 aOffset, void *aPage)
+		{
+			sqlite3_file *r = real(aFile);
+			if (r->pMethods->iVersion < 3)
+			{
+				return SQLITE_OK;
+			}
+			return r->pMethods->xUnfetch(r, aOffset, aPage);
+		}
+
+		static int xOpen(sqlite3_vfs *aVfs, const char *aName, sqlite3_file *aFile, int aFlags, int *aOutFlags)
+		{
+			StatsVfs *vfs = owner(aVfs);
+			File *f = (File*)aFile;
+			memset(f, 0, sizeof(File));
+			f->owner = vfs;
+			f->window = MIN_WINDOW;
+			if (aFlags & SQLITE_OPEN_MAIN_DB)
+			{
+				f->type = DB_FILE;
+			}
+			else if (aFlags & SQLITE_OPEN_WAL)
+			{
+				f->type = WAL_FILE;
+			}
+			else if (aFlags & SQLITE_OPEN_MAIN_JOURNAL)
+			{
+				f->type = JOURNAL_FILE;
+			}
+			else
+			{
+				f->type = OTHER_FILE;
+			}
+
+			sqlite3_file *r = real(aFile);
+			int rc = vfs->parent->xOpen(vfs->parent, aName, r, aFlags, aOutFlags);
+			if (r->pMethods)
+			{
+				f->counters = track(vfs, f->type);
+				if (!f->counters)
+				{
+					r->pMethods->xClose(r);
+					r->pMethods = NULL;
+					rc = SQLITE_NOMEM;
+				}
+			}
+			// SQLite calls xClose only if pMethods is set
+			f->base.pMethods = r->pMethods ? &methods : NULL;
+			// WAL frames are rewritten in place once the log restarts
+			f->readAhead = vfs->readAhead && f->type == DB_FILE;
+			return rc;
+		}
+		static int xDelete(sqlite3_vfs *aVfs, const char *aName, int aSync)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xDelete(p, aName, aSync);
+		}
+		static int xAccess(sqlite3_vfs *aVfs, const char *aName, int aFlags, int *aResult)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xAccess(p, aName, aFlags, aResult);
+		}
+		static int xFullPathname(sqlite3_vfs *aVfs, const char *aName, int aLength, char *aOut)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xFullPathname(p, aName, aLength, aOut);
+		}
+		static void *xDlOpen(sqlite3_vfs *aVfs, const char *aName)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xDlOpen(p, aName);
+		}
+		static void xDlError(sqlite3_vfs *aVfs, int aLength, char *aOut)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			p->xDlError(p, aLength, aOut);
+		}
+		static void (*xDlSym(sqlite3_vfs *aVfs, void *aHandle, const char *aSymbol))(void)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xDlSym(p, aHandle, aSymbol);
+		}
+		static void xDlClose(sqlite3_vfs *aVfs, void *aHandle)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			p->xDlClose(p, aHandle);
+		}
+		static int xRandomness(sqlite3_vfs *aVfs, int aLength, char *aOut)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xRandomness(p, aLength, aOut);
+		}
+		static int xSleep(sqlite3_vfs *aVfs, int aMicros)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xSleep(p, aMicros);
+		}
+		static int xCurrentTime(sqlite3_vfs *aVfs, double *aOut)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xCurrentTime(p, aOut);
+		}
+		static int xGetLastError(sqlite3_vfs *aVfs, int aLength, char *aOut)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xGetLastError ? p->xGetLastError(p, aLength, aOut) : 0;
+		}
+		static int xCurrentTimeInt64(sqlite3_vfs *aVfs, sqlite3_int64 *aOut)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xCurrentTimeInt64(p, aOut);
+		}
+		static int xSetSystemCall(sqlite3_vfs *aVfs, const char *aName, sqlite3_syscall_ptr aCall)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xSetSystemCall(p, aName, aCall);
+		}
+		static sqlite3_syscall_ptr xGetSystemCall(sqlite3_vfs *aVfs, const char *aName)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xGetSystemCall(p, aName);
+		}
+		static const char *xNextSystemCall(sqlite3_vfs *aVfs, const char *aName)
+		{
+			sqlite3_vfs *p = owner(aVfs)->parent;
+			return p->xNextSystemCall(p, aName);
+		}
+	};
+
+	const sqlite3_io_methods StatsVfsShim::methods = {
+		3,
+		StatsVfsShim::xClose,
+		StatsVfsShim::xRead,
+		StatsVfsShim::xWrite,
+		StatsVfsShim::xTruncate,
+		StatsVfsShim::xSync,
+		StatsVfsShim::xFileSize,
+		StatsVfsShim::xLock,
+		StatsVfsShim::xUnlock,
+		StatsVfsShim::xCheckReservedLock,
+		StatsVfsShim::xFileControl,
+		StatsVfsShim::xSectorSize,
+		StatsVfsShim::xDeviceCharacteristics,
+		StatsVfsShim::xShmMap,
+		StatsVfsShim::xShmLock,
+		StatsVfsShim::xShmBarrier,
+		StatsVfsShim::xShmUnmap,
+		StatsVfsShim::xFetch,
+		StatsVfsShim::xUnfetch
+	};
+
+	StatsVfs::StatsVfs(const string& aName, bool aReadAhead, const char *aParent)
+		: name(aName), parent(sqlite3_vfs_find(aParent)), readAhead(aReadAhead), mutex(NULL)
+	{
+		if (!parent)
+		{
+			throw Exception(string("No such VFS: ") + (aParent ? aParent : "default"));
+		}
+		memset(&vfs, 0, sizeof(vfs));
+		vfs.iVersion = parent->iVersion < 3 ? parent->iVersion : 3;
+		vfs.szOsFile = (int)sizeof(StatsVfsShim::File) + parent->szOsFile;
+		vfs.mxPathname = parent->mxPathname;
+		vfs.zName = name.c_str();
+		vfs.pAppData = this;
+		vfs.xOpen = StatsVfsShim::xOpen;
+		vfs.xDelete = StatsVfsShim::xDelete;
+		vfs.xAccess = StatsVfsShim::xAccess;
+		vfs.xFullPathname = StatsVfsShim::xFullPathname;
+		vfs.xDlOpen = parent->xDlOpen ? StatsVfsShim::xDlOpen : NULL;
+		vfs.xDlError = parent->xDlError ? StatsVfsShim::xDlError : NULL;
+		vfs.xDlSym = parent->xDlSym ? StatsVfsShim::xDlSym : NULL;
+		vfs.xDlClose = parent->xDlClose ? StatsVfsShim::xDlClose : NULL;
+		vfs.xRandomness = StatsVfsShim::xRandomness;
+		vfs.xSleep = StatsVfsShim::xSleep;
+		vfs.xCurrentTime = StatsVfsShim::xCurrentTime;
+		vfs.xGetLastError = StatsVfsShim::xGetLastError;
+		if (vfs.iVersion >= 2)
+		{
+			vfs.xCurrentTimeInt64 = parent->xCurrentTimeInt64 ? StatsVfsShim::xCurrentTimeInt64 : NULL;
+		}
+		if (vfs.iVersion >= 3)
+		{
+			vfs.xSetSystemCall = parent->xSetSystemCall ? StatsVfsShim::xSetSystemCall : NULL;
+			vfs.xGetSystemCall = parent->xGetSystemCall ? StatsVfsShim::xGetSystemCall : NULL;
+			vfs.xNextSystemCall = parent->xNextSystemCall ? StatsVfsShim::xNextSystemCall : NULL;
+		}
+
+		mutex = new Mutex;
+		int rc = sqlite3_vfs_register(&vfs, 0);
+		if (rc != SQLITE_OK)
+		{
+			delete mutex;
+			throw Exception(rc);
+		}
+	}
+	StatsVfs::~StatsVfs()
+	{
+		sqlite3_vfs_unregister(&vfs);
+		delete mutex;
+	}
+
+	VfsStats StatsVfs::getStats() const
+	{
+		Lock lock(*mutex);
+		VfsStats rv = stats;
+		for (unsigned i = 0; i < files.size(); ++i)
+		{
+			Lock fileLock(files[i]->mutex);
+			StatsVfsShim::add(StatsVfsShim::pick(rv, files[i]->type), files[i]->stats);
+		}
+		return rv;
+	}
+	VfsStats StatsVfs::resetStats()
+	{
+		Lock lock(*mutex);
+		VfsStats rv = stats;
+		stats = VfsStats();
+		for (unsigned i = 0; i < files.size(); ++i)
+		{
+			Lock fileLock(files[i]->mutex);
+			StatsVfsShim::add(StatsVfsShim::pick(rv, files[i]->type), files[i]->stats);
+			files[i]->stats = IoStats();
+		}
+		return rv;
+	}
+}
@@ -0,0 +1,614 @@
+/*
+** 2006 March 18
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+*/
+
+/*
+** Load generator: runs a mix of point reads, range scans, inserts and
+** updates from several threads over a number of shared connections and
+** prints throughput, latency percentiles and lock contention as JSON.
+**
+**   sqlitepp_loadgen --db=load.db --threads=16 --connections=4
+**       --seconds=10 --mix=70,10,10,10
+*/
+
+#include "SQLite.h"
+#include "SQLiteThread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+using namespace SQLite;
+
+namespace
+{
+	enum Op
+	{
+		READ,
+		SCAN,
+		INSERT,
+		UPDATE,
+		OPS
+	};
+	const char *const opNames[OPS] = {"read", "scan", "insert", "update"};
+	const char *const opQueries[OPS] = {
+		"SELECT payload FROM kv WHERE id = ?",
+		"SELECT id, payload FROM kv WHERE id >= ? ORDER BY id LIMIT ?",
+		"INSERT INTO kv(id, n, payload) VALUES(?1, ?1 % 1000, ?2)",
+		"UPDATE kv SET n = n + 1, payload = ?2 WHERE id = ?1"
+	};
+
+	class Config
+	{
+	public:
+		string db;
+		unsigned threads;
+		unsigned connections;
+		unsigned seconds;
+		unsigned rows;
+		unsigned scanRows;
+		unsigned payload;
+		// weights, in Op order
+		unsigned mix[OPS];
+		string journal;
+		int cacheSize;
+		bool fresh;
+
+		Config()
+			: db("loadgen.db"), threads(8), connections(4), seconds(10), rows(100000),
+			scanRows(100), payload(100), journal("wal"), cacheSize(0), fresh(false)
+		{
+			mix[READ] = 70;
+			mix[SCAN] = 10;
+			mix[INSERT] = 10;
+			mix[UPDATE] = 10;
+		}
+	};
+
+	// Latencies in microseconds, bucketed like HdrHistogram: exact below
+	// 128, then 64 buckets per power of two (within 1.6%)
+	class Histogram
+	{
+	public:
+		enum
+		{
+			LINEAR = 128,
+			SUB = 64,
+			BUCKETS = LINEAR + 48 * SUB
+		};
+
+		vector<__int64> counts;
+		__int64 total;
+		__int64 sum;
+		__int64 max;
+
+		Histogram()
+			: counts(BUCKETS, 0), total(0), sum(0), max(0)
+		{}
+
+		static unsigned index(__int64 aValue)
+		{
+			if (aValue < LINEAR)
+			{
+				return aValue < 0 ? 0 : (unsigned)aValue;
+			}
+			unsigned shift = 1;
+			while ((aValue >> shift) >= 2 * SUB)
+			{
+				shift++;
+			}
+			unsigned i = LINEAR + (shift - 1) * SUB + (unsigned)((aValue >> shift) - SUB);
+			return i < BUCKETS ? i : BUCKETS - 1;
+		}
+		// the highest value counted in bucket aIndex
+		static __int64 upper(unsigned aIndex)
+		{
+			if (aIndex < LINEAR)
+			{
+				return aIndex;
+			}
+			unsigned shift = (aIndex - LINEAR) / SUB + 1;
+			__int64 sub = (aIndex - LINEAR) % SUB + SUB;
+			return ((sub + 1) << shift) - 1;
+		}
+
+		void record(__int64 aValue)
+		{
+			counts[index(aValue)]++;
+			total++;
+			sum += aValue;
+			if (aValue > max)
+			{
+				max = aValue;
+			}
+		}
+		void add(const Histogram& aOther)
+		{
+			for (unsigned i = 0; i < BUCKETS; ++i)
+			{
+				counts[i] += aOther.counts[i];
+			}
+			total += aOther.total;
+			sum += aOther.sum;
+			if (aOther.max > max)
+			{
+				max = aOther.max;
+			}
+		}
+		__int64 percentile(double aPercent) const
+		{
+			__int64 rank = (__int64)(aPercent / 100.0 * (double)total + 0.5);
+			if (rank < 1)
+			{
+				rank = 1;
+			}
+			__int64 seen = 0;
+			for (unsigned i = 0; i < BUCKETS; ++i)
+			{
+				seen += counts[i];
+				if (seen >= rank)
+				{
+					__int64 rv = upper(i);
+					return rv < max ? rv : max;
+				}
+			}
+			return max;
+		}
+	};
+
+	// Threads sharing a connection take turns on it, like an
+	// application would
+	class Connection
+	{
+	public:
+		DB db;
+		Mutex mutex;
+
+		explicit Connection(const string& aPath)
+			: db(aPath)
+		{}
+	};
+
+	class Rows : public DataItr
+	{
+	private:
+		unsigned count;
+		unsigned id;
+		string payload;
+
+	public:
+		Rows(unsigned aCount, unsigned aPayload)
+			: count(aCount), id(0), payload(aPayload, 'x')
+		{}
+		virtual bool next()
+		{
+			return id++ < count;
+		}
+		virtual void bind(Stmt& aStmt)
+		{
+			aStmt.bind(1, (int)id);
+			aStmt.bind(2, (int)(id % 1000));
+			aStmt.bind(3, payload);
+		}
+	};
+
+	volatile long stopping = 0;
+	volatile long nextId = 0;
+
+	class Worker : public Thread
+	{
+	private:
+		const Config& config;
+		Connection& conn;
+		unsigned weights;
+		unsigned __int64 seed;
+
+		unsigned random()
+		{
+			// xorshift64*
+			seed ^= seed >> 12;
+			seed ^= seed << 25;
+			seed ^= seed >> 27;
+			return (unsigned)((seed * 2685821657736338717ULL) >> 32);
+		}
+		int randomId()
+		{
+			return (int)(random() % config.rows) + 1;
+		}
+
+		void execute(Op aOp, Stmt& aStmt)
+		{
+			Lock lock(conn.mutex);
+			switch (aOp)
+			{
+				case READ:
+				{
+					aStmt.bind(1, randomId());
+					if (aStmt.next())
+					{
+						aStmt[0].asString();
+					}
+					aStmt.reset();
+					break;
+				}
+				case SCAN:
+				{
+					aStmt.bind(1, randomId());
+					aStmt.bind(2, (int)config.scanRows);
+					while (aStmt.next())
+					{
+						aStmt[1].asString();
+					}
+					aStmt.reset();
+					break;
+				}
+				case INSERT:
+				case UPDATE:
+				{
+					Trans trans(conn.db, Trans::IMMEDIATE);
+					if (aOp == INSERT)
+					{
+						aStmt.bind(1, (int)atomicAdd(&nextId, 1));
+					}
+					else
+					{
+						aStmt.bind(1, randomId());
+					}
+					aStmt.bind(2, payload);
+					aStmt.execute();
+					trans.commit();
+					break;
+				}
+				default:
+					break;
+			}
+		}
+
+	public:
+		Histogram latency[OPS];
+		__int64 lockErrors;
+		__int64 errors;
+		string payload;
+
+		Worker(const Config& aConfig, Connection& aConn, unsigned aSeed)
+			: config(aConfig), conn(aConn), weights(0), seed(aSeed * 0x9E3779B97F4A7C15ULL + 1),
+			lockErrors(0), errors(0), payload(aConfig.payload, 'y')
+		{
+			for (unsigned op = 0; op < OPS; ++op)
+			{
+				weights += config.mix[op];
+			}
+		}
+
+	protected:
+		virtual void run()
+		{
+			Stmt *stmts[OPS] = {NULL};
+			while (!atomicGet(&stopping))
+			{
+				unsigned pick = random() % weights;
+				unsigned op = 0;
+				while (pick >= config.mix[op])
+				{
+					pick -= config.mix[op++];
+				}
+				__int64 start = clockMicros();
+				try
+				{
+					// prepared on first use, so that preparing on a locked
+					// schema counts like any other lock error
+					if (!stmts[op])
+					{
+						Lock lock(conn.mutex);
+						stmts[op] = new Stmt(conn.db.prepare(opQueries[op]));
+					}
+					execute((Op)op, *stmts[op]);
+				}
+				catch (Exception &ex)
+				{
+					int code = ex.getErrorCode() & 0xff;
+					if (code == SQLITE_BUSY || code == SQLITE_LOCKED)
+					{
+						lockErrors++;
+					}
+					else
+					{
+						errors++;
+					}
+					if (stmts[op])
+					{
+						Lock lock(conn.mutex);
+						stmts[op]->tryReset();
+					}
+				}
+				latency[op].record(clockMicros() - start);
+			}
+			Lock lock(conn.mutex);
+			for (unsigned op = 0; op < OPS; ++op)
+			{
+				delete stmts[op];
+			}
+		}
+	};
+
+	void usage()
+	{
+		fprintf(
+			stderr,
+			"usage: sqlitepp_loadgen [options]\n"
+			"  --db=FILE            database, created if needed (loadgen.db)\n"
+			"  --fresh              generate the dataset again\n"
+			"  --rows=N             rows in the dataset (100000)\n"
+			"  --payload=N          bytes of payload per row (100)\n"
+			"  --threads=N          worker threads (8)\n"
+			"  --connections=N      connections shared by the threads (4)\n"
+			"  --seconds=N          duration (10)\n"
+			"  --mix=R,S,I,U        weights of reads, scans, inserts, updates (70,10,10,10)\n"
+			"  --scan=N             rows per range scan (100)\n"
+			"  --journal=MODE       journal_mode (wal)\n"
+			"  --cache-size=N       PRAGMA cache_size of each connection\n"
+			);
+	}
+
+	bool parse(int argc, char **argv, Config& aConfig)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const char *arg = argv[i];
+			const char *value = strchr(arg, '=');
+			string name = value ? string(arg, value - arg) : string(arg);
+			value = value ? value + 1 : "";
+			if (name == "--db")
+			{
+				aConfig.db = value;
+			}
+			else if (name == "--fresh")
+			{
+				aConfig.fresh = true;
+			}
+			else if (name == "--rows")
+			{
+				aConfig.rows = (unsigned)atoi(value);
+			}
+			else if (name == "--payload")
+			{
+				aConfig.payload = (unsigned)atoi(value);
+			}
+			else if (name == "--threads")
+			{
+				aConfig.threads = (unsigned)atoi(value);
+			}
+			else if (name == "--connections")
+			{
+				aConfig.connections = (unsigned)atoi(value);
+			}
+			else if (name == "--seconds")
+			{
+				aConfig.seconds = (unsigned)atoi(value);
+			}
+			else if (name == "--mix")
+			{
+				unsigned mix[OPS] = {0, 0, 0, 0};
+				if (sscanf(value, "%u,%u,%u,%u", &mix[READ], &mix[SCAN], &mix[INSERT], &mix[UPDATE]) != OPS)
+				{
+					return false;
+				}
+				memcpy(aConfig.mix, mix, sizeof(mix));
+			}
+			else if (name == "--scan")
+			{
+				aConfig.scanRows = (unsigned)atoi(value);
+			}
+			else if (name == "--journal")
+			{
+				aConfig.journal = value;
+			}
+			else if (name == "--cache-size")
+			{
+				aConfig.cacheSize = atoi(value);
+			}
+			else
+			{
+				return false;
+			}
+		}
+		unsigned weights = 0;
+		for (unsigned op = 0; op < OPS; ++op)
+		{
+			weights += aConfig.mix[op];
+		}
+		return weights && aConfig.threads && aConfig.connections && aConfig.rows;
+	}
+
+	void prepareDataset(const Config& aConfig)
+	{
+		DB db(aConfig.db);
+		db.execute(mprintf("PRAGMA journal_mode = %s", aConfig.journal.c_str()));
+		if (aConfig.fresh)
+		{
+			db.execute(string("DROP TABLE IF EXISTS kv"));
+		}
+		bool exists;
+		{
+			Stmt stmt = db.prepare("SELECT count(*) FROM sqlite_master WHERE type = 'table' AND name = 'kv'");
+			stmt.next();
+			exists = (int)stmt[0] != 0;
+		}
+		if (!exists)
+		{
+			fprintf(stderr, "generating %u rows\n", aConfig.rows);
+			db.execute(string("CREATE TABLE kv(id INTEGER PRIMARY KEY, n INTEGER, payload TEXT)"));
+			db.execute(string("CREATE INDEX kv_n ON kv(n)"));
+			Rows rows(aConfig.rows, aConfig.payload);
+			db.executeMany("INSERT INTO kv(id, n, payload) VALUES(?, ?, ?)", rows, Trans::IMMEDIATE);
+		}
+		Stmt stmt = db.prepare("SELECT coalesce(max(id), 0) FROM kv");
+		stmt.next();
+		atomicSet(&nextId, (long)stmt[0].asInt64());
+	}
+
+	string json(const string& aText)
+	{
+		string rv;
+		for (unsigned i = 0; i < aText.length(); ++i)
+		{
+			unsigned char c = (unsigned char)aText[i];
+			if (c == '"' || c == '\\')
+			{
+				rv += '\\';
+				rv += (char)c;
+			}
+			else if (c < 0x20)
+			{
+				char buf[8];
+				sprintf(buf, "\\u%04x", c);
+				rv += buf;
+			}
+			else
+			{
+				rv += (char)c;
+			}
+		}
+		return rv;
+	}
+
+	void printOp(const char *aName, const Histogram& aLatency, double aSeconds, bool aLast)
+	{
+		printf(
+			"    \"%s\": {\"count\": %lld, \"throughput\": %.1f, \"mean\": %.1f, "
+			"\"p50\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld}%s\n",
+			aName,
+			(long long)aLatency.total,
+			aSeconds > 0 ? aLatency.total / aSeconds : 0.0,
+			aLatency.total ? (double)aLatency.sum / aLatency.total : 0.0,
+			(long long)aLatency.percentile(50),
+			(long long)aLatency.percentile(99),
+			(long long)aLatency.percentile(99.9),
+			(long long)aLatency.max,
+			aLast ? "" : ","
+			);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Config config;
+	if (!parse(argc, argv, config))
+	{
+		usage();
+		return 2;
+	}
+
+	vector<Connection*> conns;
+	vector<Worker*> workers;
+	int rv = 0;
+	try
+	{
+		prepareDataset(config);
+		for (unsigned c = 0; c < config.connections; ++c)
+		{
+			conns.push_back(new Connection(config.db));
+			if (config.cacheSize)
+			{
+				conns.back()->db.execute(mprintf("PRAGMA cache_size = %d", config.cacheSize));
+			}
+		}
+		for (unsigned t = 0; t < config.threads; ++t)
+		{
+			workers.push_back(new Worker(config, *conns[t % config.connections], t + 1));
+		}
+
+		Library::stats(true);
+		__int64 start = clockMicros();
+		for (unsigned t = 0; t < workers.size(); ++t)
+		{
+			workers[t]->start();
+		}
+		Signal().wait(config.seconds * 1000);
+		atomicSet(&stopping, 1);
+		for (unsigned t = 0; t < workers.size(); ++t)
+		{
+			workers[t]->join();
+		}
+		double seconds = (clockMicros() - start) / 1e6;
+		LibraryStats library = Library::stats();
+
+		Histogram latency[OPS], all;
+		__int64 lockErrors = 0, errors = 0;
+		for (unsigned t = 0; t < workers.size(); ++t)
+		{
+			for (unsigned op = 0; op < OPS; ++op)
+			{
+				latency[op].add(workers[t]->latency[op]);
+				all.add(workers[t]->latency[op]);
+			}
+			lockErrors += workers[t]->lockErrors;
+			errors += workers[t]->errors;
+		}
+
+		printf("{\n");
+		printf(
+			"  \"config\": {\"db\": \"%s\", \"threads\": %u, \"connections\": %u, \"rows\": %u, "
+			"\"payload\": %u, \"scan\": %u, \"mix\": [%u, %u, %u, %u], \"journal\": \"%s\", \"cacheSize\": %d},\n",
+			json(config.db).c_str(),
+			config.threads,
+			config.connections,
+			config.rows,
+			config.payload,
+			config.scanRows,
+			config.mix[READ],
+			config.mix[SCAN],
+			config.mix[INSERT],
+			config.mix[UPDATE],
+			json(config.journal).c_str(),
+			config.cacheSize
+			);
+		printf("  \"seconds\": %.3f,\n", seconds);
+		printf("  \"latencyUnit\": \"us\",\n");
+		printf("  \"busyWaits\": %lld,\n", (long long)library.busyWaits);
+		printf("  \"lockErrors\": %lld,\n", (long long)lockErrors);
+		printf("  \"errors\": %lld,\n", (long long)errors);
+		printf("  \"memoryHighwater\": %lld,\n", (long long)library.memoryHighwater);
+		printf("  \"operations\": {\n");
+		for (unsigned op = 0; op < OPS; ++op)
+		{
+			printOp(opNames[op], latency[op], seconds, false);
+		}
+		printOp("all", all, seconds, true);
+		printf("  }\n}\n");
+	}
+	catch (Exception &ex)
+	{
+		atomicSet(&stopping, 1);
+		for (unsigned t = 0; t < workers.size(); ++t)
+		{
+			workers[t]->join();
+		}
+#ifdef __BORLANDC__
+		fprintf(stderr, "error: %s\n", ex.Message.c_str());
+#else
+		fprintf(stderr, "error: %s\n", ex.getErrorMsg().c_str());
+#endif
+		rv = 1;
+	}
+
+	for (unsigned t = 0; t < workers.size(); ++t)
+	{
+		delete workers[t];
+	}
+	for (unsigned c = 0; c < conns.size(); ++c)
+	{
+		delete conns[c];
+	}
+	return rv;
+}